@@ -7,6 +7,7 @@
 */
 
 #define _binarydb_
+#define _GNU_SOURCE             /* for copy_file_range() */
 
 #include "defs.h"
 
@@ -19,6 +20,13 @@
 #include <fcntl.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
+
+#ifdef HAVE_LINUX_FS_H
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#undef BLOCK_SIZE               /* the kernel's, not ours */
+#endif
 
 #include "cdc_types.h"
 #include "cdc_string.h"
@@ -54,6 +62,20 @@ pthread_mutex_t db_mutex;
 #include <direct.h>
 #endif
 
+#ifdef USE_WRITEBACK_THREAD
+#include <pthread.h>
+#endif
+
+#ifdef USE_MMAP_OBJECTS
+#include <sys/mman.h>
+#include <stddef.h>
+#include <limits.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
 /* suggested by xmath as possibly faster
 #define NEEDED(n, b)    (((n) + ((b) - 1)) / (b))
 #define ROUND_UP(n, b)  (((n) + ((b) - 1)) % (b))
@@ -62,33 +84,132 @@ pthread_mutex_t db_mutex;
 #define NEEDED(n, b)    (((n) % (b)) ? (n) / (b) + 1 : (n) / (b))
 #define ROUND_UP(a, m)  (((a) - 1) + (m) - (((a) - 1) % (m)))
 
-#define BLOCK_SIZE          256         /* Default block size */
 #define DB_BITBLOCK         10240       /* Bitmap growth in blocks */
-#define LOGICAL_BLOCK(off)  ((off) / BLOCK_SIZE)
-#define BLOCK_OFFSET(block) ((block) * BLOCK_SIZE)
+#define COMPACT_THRESHOLD   20          /* % of the file free before compacting */
+#define COMPACT_MIN_BLOCKS  1024        /* but never for less than this */
+#define LOGICAL_BLOCK(off)  ((off) / block_size)
+#define BLOCK_OFFSET(block) ((off_t) (block) * block_size)
+#define DUMP_BUFFER         65536       /* Bytes copied to a dump at once */
+
+/* the block bitmaps are kept in 64 bit words, block b being bit b % 64
+   of word b / 64 */
+typedef uint64_t bitword;
+
+#define WORD_BITS           64
+#define BITWORDS(blocks)    (((blocks) + WORD_BITS - 1) / WORD_BITS)
+#define ALL_BITS            (~(bitword) 0)
 
 static void simble_mark(off_t start, Int size);
 static void simble_unmark(off_t start, Int size);
 static void simble_grow_bitmap(Int new_blocks);
 static Int  simble_alloc(Int size);
+static void simble_init_extents(void);
+static void simble_free_extents(void);
+static void extents_free(Int start, Int blocks);
+static void extents_take(Int start, Int blocks);
 static void simble_flag_as_clean(void);
 static void simble_flag_as_dirty(void);
+static void simble_recover_reblock(void);
 static void simble_verify_clean(void);
 
-static Int last_free = 0;        /* Last known or suspected free block */
+#ifdef USE_OBJECT_LOG
+static void log_open(char *name, Int cnew);
+static void log_replay(void);
+static off_t log_entry(cObjnum objnum);
+static Int  log_get(Obj *object, off_t rec, Long *sizeread);
+static Int  log_put(Obj *obj, cObjnum objnum, Long *sizewritten);
+static Int  log_del(cObjnum objnum);
+static void log_commit(void);
+#endif
+
+static int database_fd = -1;     /* raw descriptor for the objects file */
 
-static FILE *database_file = NULL;
+#ifdef USE_MMAP_OBJECTS
+static char   *map_base = NULL;  /* one header page, then the objects file */
+static size_t  map_total = 0;
+static off_t   map_len = 0;      /* bytes of the objects file mapped */
+static off_t   map_room = 0;     /* bytes the file may grow to in place */
+static cBuf   *map_buf = NULL;   /* buffer whose s[] is the mapped file */
+#endif
+
+#ifdef USE_OBJECT_LOG
+typedef struct log_header log_header;
+struct log_header {
+    cObjnum objnum;             /* INV_OBJNUM for a commit mark */
+    Long    size;               /* of the packed object, -1 for a deletion */
+    uLong   check;              /* of the above and the packed object */
+};
+
+static int      log_fd = -1;
+static off_t    log_end;        /* where the next record goes */
+static off_t    log_committed;  /* end of the last commit mark */
+static off_t    log_folded;     /* records before this are in objects */
+static Int      log_pending;    /* records since the last commit mark */
+static int      old_fd = -1;    /* log.old, committed and being folded */
+static off_t    old_end;
+static off_t    old_folded;
+static char     log_name[BUF],
+                old_name[BUF];
+static off_t  * log_index = NULL;   /* see log_entry() */
+static cObjnum  log_index_size = 0;
+#endif
 
-static char *dump_bitmap  = NULL;
+static bitword *dump_bitmap = NULL;
 static Int   dump_blocks;
 static off_t last_dumped;
 
-static char *bitmap = NULL;
+static bitword *bitmap = NULL;
 static Int bitmap_blocks = 0;
 static Int allocated_blocks = 0;
 
+static Int     compacting = 0;      /* a pass of simble_compact() is on */
+static cObjnum compact_next;        /* the next object it looks at */
+static Int     compact_target;      /* objects past this block are moved */
+static Int     compact_moved;       /* objects this pass has moved */
+static Int     compact_after = 0;   /* free space a fruitless pass left */
+#ifdef USE_OBJECT_LOG
+static Int   * compact_freed = NULL;    /* start, size of moved objects */
+static Int     compact_freed_count = 0,
+               compact_freed_size = 0;
+#endif
+
+/*
+// Free space is also kept as extents, runs of free blocks, so that
+// simble_alloc() need not scan the bitmap.  They are in a treap ordered
+// by starting block (to find the neighbours of freed space) and on one of
+// a set of lists by size: an exact list for each size up to EXACT_CLASSES
+// blocks, and four lists for each power of two above that.  Each tree node
+// also knows the largest extent below it, so the compactor can find the
+// lowest free space big enough for an object.
+*/
+#define EXACT_CLASSES   64
+#define EXTENT_CLASSES  (EXACT_CLASSES + 4 * 26)
+
+typedef struct extent extent;
+struct extent {
+    Int      start;
+    Int      blocks;
+    uInt     priority;
+    Int      largest;           /* of this extent and those below it */
+    extent * left,
+           * right;
+    extent * prev,
+           * next;
+};
+
+static extent * extent_root = NULL;
+static extent * extent_classes[EXTENT_CLASSES];
+static Int      extents_ready = 0;
+
 static char c_clean_file[255];
 
+static Int block_size = BLOCK_SIZE;     /* recorded in 'clean' */
+
+#define write_clean_file(_fp_) \
+    fprintf(_fp_, "%s\n%d\n%d\n%d\n%li\n%d\n", SYSTEM_TYPE, \
+                VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH,\
+                (long) MAGIC_MODNUMBER, block_size)
+
 static Int db_clean;
 static cStr *pad_string;
 
@@ -136,10 +257,10 @@ extern Long num_objects;
         if (stat(fdb_objects, &statbuf) < 0) \
             FAIL("Cannot stat database file \"%s/objects\".\n"); \
         bitmap_blocks = ROUND_UP(LOGICAL_BLOCK(statbuf.st_size) + \
-                        DB_BITBLOCK, 8); \
+                        DB_BITBLOCK, WORD_BITS); \
         allocated_blocks=0; \
-        bitmap = EMALLOC(char, (bitmap_blocks / 8)+1); \
-        memset(bitmap, 0, (bitmap_blocks / 8)+1); \
+        bitmap = EMALLOC(bitword, BITWORDS(bitmap_blocks)); \
+        memset(bitmap, 0, BITWORDS(bitmap_blocks) * sizeof(bitword)); \
     }
 
 #define sync_index() { \
@@ -155,12 +276,315 @@ extern Long num_objects;
         } \
     }
 
-#define open_db_objects(__p) { \
-        database_file = fopen(fdb_objects, __p); \
-        if (!database_file) \
+#define open_db_objects(__f) { \
+        database_fd = open(fdb_objects, (__f) | O_RDWR | O_BINARY, READ_WRITE); \
+        if (database_fd == F_FAILURE) \
             FAIL("Cannot open object database file \"%s/objects\".\n"); \
     }
 
+/*
+// -------------------------------------------------------------------------
+// Positioned I/O on the objects file (and the object log).  Neither call
+// moves a shared file offset, so each object read or write is a single
+// syscall and nothing is buffered between us and the kernel;
+// simble_flush() is the only place the file is forced out to disk.  Both
+// return the number of bytes moved, which is short only on an error or
+// (for reads) end of file.
+*/
+
+static Long db_pread(int fd, void * buf, Long size, off_t offset) {
+    Long   done = 0;
+    Long   n;
+
+    while (done < size) {
+#ifdef HAVE_PREAD
+        n = pread(fd, (char *) buf + done, size - done, offset + done);
+#else
+        if (lseek(fd, offset + done, SEEK_SET) == F_FAILURE)
+            break;
+        n = read(fd, (char *) buf + done, size - done);
+#endif
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += n;
+    }
+
+    return done;
+}
+
+static Long db_pwrite(int fd, void * buf, Long size, off_t offset) {
+    Long   done = 0;
+    Long   n;
+
+    while (done < size) {
+#ifdef HAVE_PREAD
+        n = pwrite(fd, (char *) buf + done, size - done, offset + done);
+#else
+        if (lseek(fd, offset + done, SEEK_SET) == F_FAILURE)
+            break;
+        n = write(fd, (char *) buf + done, size - done);
+#endif
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += n;
+    }
+
+    return done;
+}
+
+#ifdef USE_WRITEBACK_THREAD
+/*
+// -------------------------------------------------------------------------
+// Writeback.  simble_write() places an object as usual, then queues the
+// packed copy rather than writing it.  The writer thread takes writes off
+// wb_queue in order, makes them and moves them to wb_done, and the main
+// thread frees them from there.  Until then simble_get() reads the object
+// from its queued copy, since its blocks may not have been written yet.
+//
+// The writer only touches the queues and wb_bytes, under wb_lock, and
+// the objects file.  Writes are made in the order they were queued, so
+// blocks freed and handed to another object always end up with the new
+// owner's data.  Anything else which reads or writes the objects file
+// calls writeback_drain() first.
+*/
+
+typedef struct wb_write_s wb_write_t;
+
+struct wb_write_s {
+    cObjnum      objnum;
+    off_t        offset;
+    cBuf       * buf;            /* packed and padded, never changed */
+    Long         written;
+    wb_write_t * next;           /* on wb_queue or wb_done */
+    wb_write_t * next_hash;      /* on wb_hash */
+};
+
+#define WB_HASH 1024
+
+static pthread_mutex_t wb_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  wb_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  wb_room = PTHREAD_COND_INITIALIZER;
+static wb_write_t    * wb_queue = NULL;
+static wb_write_t   ** wb_queue_tail = &wb_queue;
+static wb_write_t    * wb_done = NULL;
+static Long            wb_bytes = 0;     /* queued and not yet written */
+static Bool            wb_running = NO;
+
+/* main thread only */
+static pthread_t       wb_thread;
+static wb_write_t    * wb_hash[WB_HASH]; /* every write not yet freed,
+                                            newest first */
+
+static void * writeback_worker(void * arg) {
+    wb_write_t * w;
+
+    pthread_mutex_lock(&wb_lock);
+    while (wb_running || wb_queue) {
+        if (!wb_queue) {
+            pthread_cond_wait(&wb_wake, &wb_lock);
+            continue;
+        }
+        w = wb_queue;
+        if (!(wb_queue = w->next))
+            wb_queue_tail = &wb_queue;
+        pthread_mutex_unlock(&wb_lock);
+
+        w->written = db_pwrite(database_fd, w->buf->s, w->buf->len, w->offset);
+
+        pthread_mutex_lock(&wb_lock);
+        w->next = wb_done;
+        wb_done = w;
+        wb_bytes -= w->buf->len;
+        pthread_cond_broadcast(&wb_room);
+    }
+    pthread_mutex_unlock(&wb_lock);
+
+    return NULL;
+}
+
+/* free the writes which have been made */
+static void writeback_reap(void) {
+    wb_write_t * w, * done, ** wp;
+
+    pthread_mutex_lock(&wb_lock);
+    done = wb_done;
+    wb_done = NULL;
+    pthread_mutex_unlock(&wb_lock);
+
+    while ((w = done)) {
+        done = w->next;
+        if (w->written != w->buf->len)
+            panic("simble_put: only wrote %l of %l bytes.",
+                  w->written, (Long) w->buf->len);
+        for (wp = &wb_hash[(uLong) w->objnum % WB_HASH]; *wp != w;
+             wp = &(*wp)->next_hash);
+        *wp = w->next_hash;
+        buffer_discard(w->buf);
+        efree(w);
+    }
+}
+
+/* wait until at most bytes are left queued */
+static void writeback_wait(Long bytes) {
+    pthread_mutex_lock(&wb_lock);
+    while (wb_bytes > bytes)
+        pthread_cond_wait(&wb_room, &wb_lock);
+    pthread_mutex_unlock(&wb_lock);
+    writeback_reap();
+}
+
+#define writeback_drain() writeback_wait(0)
+
+/* queue buf to be written at offset; consumes buf */
+static void writeback_queue(cBuf * buf, cObjnum objnum, off_t offset) {
+    wb_write_t * w;
+
+    if (buf->len < WRITEBACK_MAX)
+        writeback_wait(WRITEBACK_MAX - buf->len);
+    else
+        writeback_drain();
+
+    w = EMALLOC(wb_write_t, 1);
+    w->objnum = objnum;
+    w->offset = offset;
+    w->buf = buf;
+    w->written = 0;
+    w->next = NULL;
+    w->next_hash = wb_hash[(uLong) objnum % WB_HASH];
+    wb_hash[(uLong) objnum % WB_HASH] = w;
+
+    pthread_mutex_lock(&wb_lock);
+    *wb_queue_tail = w;
+    wb_queue_tail = &w->next;
+    wb_bytes += buf->len;
+    pthread_cond_signal(&wb_wake);
+    pthread_mutex_unlock(&wb_lock);
+}
+
+/* the latest copy of objnum still waiting to be freed, if any */
+static cBuf * writeback_find(cObjnum objnum) {
+    wb_write_t * w;
+
+    for (w = wb_hash[(uLong) objnum % WB_HASH]; w; w = w->next_hash) {
+        if (w->objnum == objnum)
+            return w->buf;
+    }
+
+    return NULL;
+}
+
+static void writeback_start(void) {
+    wb_running = YES;
+    if (pthread_create(&wb_thread, NULL, writeback_worker, NULL)) {
+        write_err("init_binary_db: unable to start the writer thread, "
+                  "writing objects in-line");
+        wb_running = NO;
+    }
+}
+
+/* make every queued write and stop the writer */
+static void writeback_stop(void) {
+    if (!wb_running)
+        return;
+
+    pthread_mutex_lock(&wb_lock);
+    wb_running = NO;
+    pthread_cond_signal(&wb_wake);
+    pthread_mutex_unlock(&wb_lock);
+
+    pthread_join(wb_thread, NULL);
+    writeback_reap();
+}
+#else
+#define writeback_drain()
+#endif
+
+#ifdef USE_MMAP_OBJECTS
+/*
+// -------------------------------------------------------------------------
+// The objects file is mapped so it can be handed to unpack_object() as an
+// ordinary cBuf: an anonymous page holds the buffer header, placed so that
+// its s[] lands on the first byte of the file, which is mapped read-only
+// right after it.  Writes made with db_pwrite() show through the shared
+// mapping.  Room is left for the file to double in size, so growing it
+// only needs a remap once it outgrows that room; until then db_extend()
+// just moves map_len up to the new end of the file.
+*/
+
+static void map_set_len(off_t len) {
+    map_len = len;
+    map_buf->len = map_buf->size = (map_len > INT_MAX) ? INT_MAX : map_len;
+}
+
+static void db_unmap(void) {
+    if (map_base) {
+        munmap(map_base, map_total);
+        map_base = NULL;
+        map_buf = NULL;
+        map_len = 0;
+        map_room = 0;
+    }
+}
+
+static Int db_remap(void) {
+    static long   page = 0;
+    struct stat   statbuf;
+    char        * base;
+    off_t         room;
+
+    db_unmap();
+
+    if (fstat(database_fd, &statbuf) == F_FAILURE || !statbuf.st_size)
+        return 0;
+
+    if (!page)
+        page = sysconf(_SC_PAGESIZE);
+    room = (statbuf.st_size * 2 + page - 1) / page * page;
+    map_total = page + room;
+    base = mmap(NULL, map_total, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+        return 0;
+
+    /* the pages past the end of the file are not touched until it has
+       grown over them, see db_extend() */
+    if (mmap(base + page, room, PROT_READ,
+             MAP_SHARED | MAP_FIXED, database_fd, 0) == MAP_FAILED) {
+        write_err("ERROR: Unable to map object database: %s", strerror(errno));
+        munmap(base, map_total);
+        return 0;
+    }
+
+    map_base = base;
+    map_room = room;
+    map_buf = (cBuf *) (base + page - offsetof(cBuf, s));
+    map_buf->refs = 1;
+    map_set_len(statbuf.st_size);
+
+    return 1;
+}
+
+/* make sure the mapping reaches end, if the file does */
+static Int db_extend(off_t end) {
+    struct stat statbuf;
+
+    if (map_base && end <= map_room) {
+        if (fstat(database_fd, &statbuf) == F_FAILURE)
+            return 0;
+        if (statbuf.st_size <= map_room) {
+            map_set_len(statbuf.st_size);
+            return end <= map_len;
+        }
+    }
+
+    return db_remap() && end <= map_len;
+}
+#endif
+
 #ifndef __Win32__
 static Bool good_perms(struct stat * sb) {
     if (!geteuid())
@@ -173,6 +597,44 @@ static Bool good_perms(struct stat * sb) {
 }
 #endif
 
+/* finish or undo a simble_reblock() which was interrupted */
+static void simble_recover_reblock(void) {
+    struct stat statbuf;
+    char        fdb_objects[BUF],
+                fdb_new[BUF],
+                fdb_old[BUF],
+                fdb_index_new[BUF],
+                clean_new[sizeof(c_clean_file) + 4];
+
+    DBFILE(fdb_old, "objects.old");
+    if (stat(fdb_old, &statbuf) == F_FAILURE)
+        return;
+    DBFILE(fdb_objects, "objects");
+    DBFILE(fdb_new, "objects.new");
+    DBFILE(fdb_index_new, "index.objnum.new");
+    sprintf(clean_new, "%s.new", c_clean_file);
+
+    if (stat(fdb_index_new, &statbuf) != F_FAILURE) {
+        /* the old index is still in place; objects.old may still be a
+           link to objects, in which case rename() leaves both names */
+        if (rename(fdb_old, fdb_objects) == F_FAILURE)
+            FAIL("Cannot restore object database file \"%s/objects\".\n");
+        unlink(fdb_old);
+        unlink(fdb_new);
+        unlink(fdb_index_new);
+        unlink(clean_new);
+        fprintf(errfile, "[%s] Undid an unfinished change of block size\n",
+                timestamp(NULL));
+    } else {
+        if (stat(clean_new, &statbuf) != F_FAILURE &&
+            rename(clean_new, c_clean_file) == F_FAILURE)
+            FAIL("Cannot replace file \"%s/.clean\".\n");
+        unlink(fdb_old);
+        fprintf(errfile, "[%s] Finished an unfinished change of block size\n",
+                timestamp(NULL));
+    }
+}
+
 static void simble_verify_clean(void) {
     Bool isdirty = YES;
     char system[LINE],
@@ -180,12 +642,12 @@ static void simble_verify_clean(void) {
          v_minor[LINE],
          v_patch[LINE],
          magicmod[LINE],
-         search[LINE];
+         blocks[LINE];
     char * s;
     FILE * fp;
 
     v_major[0] = v_minor[0] = v_patch[0] = magicmod[0] =
-        system[0] = search[0] = '\0';
+        system[0] = blocks[0] = '\0';
 
     if ((fp = fopen(c_clean_file, "rb"))) {
         fgets(system, LINE, fp);
@@ -193,7 +655,7 @@ static void simble_verify_clean(void) {
         fgets(v_minor, LINE, fp);
         fgets(v_patch, LINE, fp);
         fgets(magicmod, LINE, fp);
-        fgets(search, LINE, fp);
+        fgets(blocks, LINE, fp);
 
         /* cleanup anything after the system name */
         s = &system[strlen(system)-1];
@@ -220,6 +682,11 @@ static void simble_verify_clean(void) {
         FAIL("Binary database (\"%s\") is corrupted, aborting...\n");
     }
 
+    /* databases from before the block size was recorded used the default */
+    block_size = *blocks ? atoi(blocks) : BLOCK_SIZE;
+    if (!VALID_BLOCK_SIZE(block_size))
+        FAIL("Binary database (\"%s\") has an invalid block size.\n");
+
     if (isdirty) {
         fprintf(stderr, "** Binary database \"%s\" is incompatible, systems:\n"
                         "** it:   <%s> %d.%d-%d (module key %li)\n"
@@ -234,19 +701,23 @@ static void simble_verify_clean(void) {
 void init_binary_db(void) {
     struct stat   statbuf;
     char          fdb_objects[BUF],
-                  fdb_index[BUF];
+                  fdb_index[BUF],
+                  fdb_log[BUF];
     off_t         offset;
     Int           size;
     cObjnum       objnum;
+#ifndef USE_OBJECT_LOG
+    Int           logged;
+#endif
 
 #ifdef USE_CLEANER_THREAD
     pthread_mutex_init (&db_mutex, NULL);
 #endif
 
-    pad_string = string_of_char(0, 256);
     sprintf(c_clean_file, "%s/.clean", c_dir_binary);
     DBFILE(fdb_objects, "objects");
     DBFILE(fdb_index,   "index");
+    DBFILE(fdb_log,     "log");
 
     if (stat(c_dir_binary, &statbuf) == F_FAILURE)
         FAIL("Cannot find binary directory \"%s\".\n")
@@ -263,22 +734,46 @@ void init_binary_db(void) {
 #endif
 
     /* check the clean file */
+    simble_recover_reblock();
     simble_verify_clean();
+    pad_string = string_of_char(0, block_size);
+
+#ifndef USE_OBJECT_LOG
+    /* left by a server built with USE_OBJECT_LOG which was not shut down
+       cleanly; its committed records are not all in the objects file */
+    logged = stat(fdb_log, &statbuf) != F_FAILURE && statbuf.st_size;
+    DBFILE(fdb_log, "log.old");
+    if (logged || stat(fdb_log, &statbuf) != F_FAILURE)
+        FAIL("Binary database \"%s\" has an object log, start it with a "
+             "server built with USE_OBJECT_LOG.\n");
+#endif
 
-    open_db_objects("rb+");
+    open_db_objects(0);
+#ifdef USE_MMAP_OBJECTS
+    db_remap();
+#endif
     lookup_open(fdb_index, 0);
     init_bitmaps();
     sync_index();
+    simble_init_extents();
+#ifdef USE_OBJECT_LOG
+    log_open(fdb_log, 0);
+    log_replay();
+#endif
     fprintf (errfile, "[%s] Binary database free space: %.2f%%\n",
              timestamp(NULL), (100.0 * simble_fragmentation()));
 
     db_clean = 1;
+#ifdef USE_WRITEBACK_THREAD
+    writeback_start();
+#endif
 }
 
 void init_new_db(void) {
     struct stat   statbuf;
     char          fdb_objects[BUF],
-                  fdb_index[BUF];
+                  fdb_index[BUF],
+                  fdb_log[BUF];
     off_t         offset;
     Int           size;
     cObjnum       objnum;
@@ -288,42 +783,383 @@ void init_new_db(void) {
 #endif
     LOCK_DB("init_new_db")
 
-    pad_string = string_of_char(0, 256);
+    block_size = new_block_size;
+    pad_string = string_of_char(0, block_size);
     sprintf(c_clean_file, "%s/.clean", c_dir_binary);
     DBFILE(fdb_objects, "objects");
     DBFILE(fdb_index,   "index");
+    DBFILE(fdb_log,     "log");
 
     open_db_directory();
-    open_db_objects("wb+");
+    open_db_objects(O_CREAT | O_TRUNC);
     lookup_open(fdb_index, 1);
     init_bitmaps();
     sync_index();
+    simble_init_extents();
+#ifdef USE_OBJECT_LOG
+    log_open(fdb_log, 1);
+#endif
     simble_flag_as_clean();
     UNLOCK_DB("init_new_db")
 }
 
+/*
+// -------------------------------------------------------------------------
+// Block bitmaps, a word at a time.
+*/
+
+#ifdef __GNUC__
+#define word_ctz(w) __builtin_ctzll(w)
+#else
+static Int word_ctz(bitword w) {
+    Int n = 0;
+
+    while (!(w & 1)) {
+        w >>= 1;
+        n++;
+    }
+    return n;
+}
+#endif
+
+/* the bits of a word from bit lo up to and including bit hi */
+#define WORD_MASK(lo, hi) \
+        ((ALL_BITS << (lo)) & (ALL_BITS >> (WORD_BITS - 1 - (hi))))
+
+static void bits_set(bitword * map, Int start, Int blocks) {
+    Int w = start / WORD_BITS,
+        last = (start + blocks - 1) / WORD_BITS;
+
+    if (blocks <= 0)
+        return;
+    if (w == last) {
+        map[w] |= WORD_MASK(start % WORD_BITS, (start + blocks - 1) % WORD_BITS);
+        return;
+    }
+    map[w++] |= ALL_BITS << (start % WORD_BITS);
+    while (w < last)
+        map[w++] = ALL_BITS;
+    map[last] |= WORD_MASK(0, (start + blocks - 1) % WORD_BITS);
+}
+
+static void bits_clear(bitword * map, Int start, Int blocks) {
+    Int w = start / WORD_BITS,
+        last = (start + blocks - 1) / WORD_BITS;
+
+    if (blocks <= 0)
+        return;
+    if (w == last) {
+        map[w] &= ~WORD_MASK(start % WORD_BITS, (start + blocks - 1) % WORD_BITS);
+        return;
+    }
+    map[w++] &= ~(ALL_BITS << (start % WORD_BITS));
+    while (w < last)
+        map[w++] = 0;
+    map[last] &= ~WORD_MASK(0, (start + blocks - 1) % WORD_BITS);
+}
+
+/* The first block from 'from' whose bit is set (or with 'set' false,
+   clear), or 'limit' if there is none before it.  Bits past the end of
+   a bitmap are always clear. */
+static Int bits_next(bitword * map, Int from, Int limit, Int set) {
+    Int     w = from / WORD_BITS,
+            words = BITWORDS(limit);
+    bitword flip = set ? 0 : ALL_BITS,
+            bits;
+
+    if (from >= limit)
+        return limit;
+    bits = (map[w] ^ flip) & (ALL_BITS << (from % WORD_BITS));
+    while (!bits) {
+        if (++w >= words)
+            return limit;
+        bits = map[w] ^ flip;
+    }
+    from = w * WORD_BITS + word_ctz(bits);
+    return (from < limit) ? from : limit;
+}
+
+#define bits_next_set(map, from, limit)   bits_next(map, from, limit, 1)
+#define bits_next_clear(map, from, limit) bits_next(map, from, limit, 0)
+
+/*
+// -------------------------------------------------------------------------
+// Free extents.
+*/
+
+static Int extent_class(Int blocks) {
+    Int log = 0, b;
+
+    if (blocks <= EXACT_CLASSES)
+        return blocks - 1;
+    for (b = blocks; b > 1; b >>= 1)
+        log++;
+    return EXACT_CLASSES + (log - 6) * 4 + ((blocks >> (log - 2)) & 3);
+}
+
+static void extent_link(extent * e) {
+    extent ** head = &extent_classes[extent_class(e->blocks)];
+
+    e->prev = NULL;
+    e->next = *head;
+    if (*head)
+        (*head)->prev = e;
+    *head = e;
+}
+
+static void extent_unlink(extent * e) {
+    if (e->prev)
+        e->prev->next = e->next;
+    else
+        extent_classes[extent_class(e->blocks)] = e->next;
+    if (e->next)
+        e->next->prev = e->prev;
+}
+
+#define LARGEST(t) ((t) ? (t)->largest : 0)
+
+static void tree_update(extent * t) {
+    t->largest = t->blocks;
+    if (LARGEST(t->left) > t->largest)
+        t->largest = t->left->largest;
+    if (LARGEST(t->right) > t->largest)
+        t->largest = t->right->largest;
+}
+
+static extent * tree_rotate_left(extent * t) {
+    extent * r = t->right;
+
+    t->right = r->left;
+    r->left = t;
+    tree_update(t);
+    tree_update(r);
+    return r;
+}
+
+static extent * tree_rotate_right(extent * t) {
+    extent * l = t->left;
+
+    t->left = l->right;
+    l->right = t;
+    tree_update(t);
+    tree_update(l);
+    return l;
+}
+
+static extent * tree_insert(extent * t, extent * e) {
+    if (!t)
+        return e;
+    if (e->start < t->start) {
+        t->left = tree_insert(t->left, e);
+        tree_update(t);
+        if (t->left->priority > t->priority)
+            t = tree_rotate_right(t);
+    } else {
+        t->right = tree_insert(t->right, e);
+        tree_update(t);
+        if (t->right->priority > t->priority)
+            t = tree_rotate_left(t);
+    }
+    return t;
+}
+
+static extent * tree_remove(extent * t, Int start) {
+    if (start < t->start) {
+        t->left = tree_remove(t->left, start);
+    } else if (start > t->start) {
+        t->right = tree_remove(t->right, start);
+    } else if (!t->left) {
+        return t->right;
+    } else if (!t->right) {
+        return t->left;
+    } else if (t->left->priority > t->right->priority) {
+        t = tree_rotate_right(t);
+        t->right = tree_remove(t->right, start);
+    } else {
+        t = tree_rotate_left(t);
+        t->left = tree_remove(t->left, start);
+    }
+    tree_update(t);
+    return t;
+}
+
+/* recompute the sizes on the way down to the extent at start */
+static void tree_refresh(extent * t, Int start) {
+    if (start < t->start)
+        tree_refresh(t->left, start);
+    else if (start > t->start)
+        tree_refresh(t->right, start);
+    tree_update(t);
+}
+
+/* the extent starting at or nearest before block */
+static extent * tree_floor(Int block) {
+    extent * t = extent_root,
+           * found = NULL;
+
+    while (t) {
+        if (t->start == block)
+            return t;
+        if (t->start < block) {
+            found = t;
+            t = t->right;
+        } else {
+            t = t->left;
+        }
+    }
+    return found;
+}
+
+/* the lowest extent of at least the given size, or NULL */
+static extent * tree_lowest_fit(Int blocks) {
+    extent * t = extent_root;
+
+    while (t && t->largest >= blocks) {
+        if (LARGEST(t->left) >= blocks)
+            t = t->left;
+        else if (t->blocks >= blocks)
+            return t;
+        else
+            t = t->right;
+    }
+    return NULL;
+}
+
+static void extent_add(Int start, Int blocks) {
+    static uInt seed = 2463534242U;
+    extent    * e = EMALLOC(extent, 1);
+
+    /* xorshift, for the treap */
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+
+    e->start = start;
+    e->blocks = blocks;
+    e->largest = blocks;
+    e->priority = seed;
+    e->left = e->right = NULL;
+    extent_root = tree_insert(extent_root, e);
+    extent_link(e);
+}
+
+static void extent_del(extent * e) {
+    extent_unlink(e);
+    extent_root = tree_remove(extent_root, e->start);
+    efree(e);
+}
+
+/* the start may only move within the free space around the extent, so
+   its place in the tree stays the same */
+static void extent_resize(extent * e, Int start, Int blocks) {
+    extent_unlink(e);
+    e->start = start;
+    e->blocks = blocks;
+    tree_refresh(extent_root, start);
+    extent_link(e);
+}
+
+static void extents_free(Int start, Int blocks) {
+    extent * prev = tree_floor(start - 1),
+           * next = tree_floor(start + blocks);
+
+    if (next && next->start != start + blocks)
+        next = NULL;
+
+    if (prev && prev->start + prev->blocks == start) {
+        if (next) {
+            blocks += next->blocks;
+            extent_del(next);
+        }
+        extent_resize(prev, prev->start, prev->blocks + blocks);
+    } else if (next) {
+        extent_resize(next, start, next->blocks + blocks);
+    } else {
+        extent_add(start, blocks);
+    }
+}
+
+static void extents_take(Int start, Int blocks) {
+    extent * e = tree_floor(start);
+    Int      end;
+
+    if (!e || e->start + e->blocks < start + blocks)
+        panic("simble: blocks %d-%d are not free.", start, start + blocks - 1);
+
+    end = e->start + e->blocks;
+    if (e->start == start) {
+        if (e->blocks == blocks)
+            extent_del(e);
+        else
+            extent_resize(e, start + blocks, e->blocks - blocks);
+    } else {
+        extent_resize(e, e->start, start - e->start);
+        if (start + blocks < end)
+            extent_add(start + blocks, end - start - blocks);
+    }
+}
+
+/* Best fit among the extents of the size's own list, otherwise the first
+   extent from the next larger list which has any: every extent there is
+   large enough.  NULL if nothing is. */
+static extent * extents_fit(Int blocks) {
+    extent * e,
+           * best = NULL;
+    Int      c = extent_class(blocks);
+
+    if (c < EXACT_CLASSES) {
+        if (extent_classes[c])
+            return extent_classes[c];
+    } else {
+        for (e = extent_classes[c]; e; e = e->next) {
+            if (e->blocks >= blocks && (!best || e->blocks < best->blocks))
+                best = e;
+        }
+        if (best)
+            return best;
+    }
+    for (c++; c < EXTENT_CLASSES; c++) {
+        if (extent_classes[c])
+            return extent_classes[c];
+    }
+    return NULL;
+}
+
+/* build the extents from the bitmap, once the index has been read */
+static void simble_init_extents(void) {
+    Int b, end;
+
+    for (b = bits_next_clear(bitmap, 0, bitmap_blocks);
+         b < bitmap_blocks;
+         b = bits_next_clear(bitmap, end, bitmap_blocks)) {
+        end = bits_next_set(bitmap, b, bitmap_blocks);
+        extent_add(b, end - b);
+    }
+    extents_ready = 1;
+}
+
+static void simble_free_extents(void) {
+    Int c;
+
+    while (extent_root)
+        extent_del(extent_root);
+    for (c = 0; c < EXTENT_CLASSES; c++)
+        extent_classes[c] = NULL;
+    extents_ready = 0;
+}
+
 #ifdef DEBUG
 static void display_bitmap()
 {
-    Int i=0, j=0;
+    Int  w;
     char line[80];
-    static char *hex="0123456789ABCDEF";
-
-    memset(line, 0, sizeof(line));
-    while (i < (bitmap_blocks/8))
-    {
-        line[j++] = hex[(bitmap[i] & 0xF0) >> 4];
-        line[j++] = hex[bitmap[i] & 0x0F];
-        i++;
-        if (!(i%4))
-            line[j++] = ' ';
-        if (!(i%16))
-        {
-            line[j++] = 0;
+
+    for (w = 0; w < BITWORDS(bitmap_blocks); w++) {
+        sprintf(line + (w % 4) * 17, "%08lx%08lx ",
+                (unsigned long) (bitmap[w] >> 32),
+                (unsigned long) (bitmap[w] & 0xffffffff));
+        if (w % 4 == 3 || w == BITWORDS(bitmap_blocks) - 1)
             write_err("%s", line);
-            j = 0;
-            memset(line, 0, sizeof(line));
-        }
     }
 }
 #endif
@@ -331,24 +1167,81 @@ static void display_bitmap()
 /* Grow the bitmap to given size. */
 static void simble_grow_bitmap(Int new_blocks)
 {
-    new_blocks = ROUND_UP(new_blocks, 8);
-    bitmap = EREALLOC(bitmap, char, (new_blocks / 8) + 1);
-    memset(&bitmap[bitmap_blocks / 8], 0, (new_blocks / 8) - (bitmap_blocks / 8));
+    Int old_blocks = bitmap_blocks;
+
+    new_blocks = ROUND_UP(new_blocks, WORD_BITS);
+    bitmap = EREALLOC(bitmap, bitword, BITWORDS(new_blocks));
+    memset(&bitmap[BITWORDS(bitmap_blocks)], 0,
+           (BITWORDS(new_blocks) - BITWORDS(bitmap_blocks)) * sizeof(bitword));
     bitmap_blocks = new_blocks;
+    if (extents_ready)
+        extents_free(old_blocks, new_blocks - old_blocks);
 }
 
 static void simble_mark(off_t start, Int size)
 {
-    Int i, blocks;
+    Int blocks;
 
-    blocks = NEEDED(size, BLOCK_SIZE);
+    blocks = NEEDED(size, block_size);
     allocated_blocks += blocks;
 
     while (start + blocks > bitmap_blocks)
         simble_grow_bitmap(bitmap_blocks + DB_BITBLOCK);
 
-    for (i = start; i < start + blocks; i++)
-        bitmap[i >> 3] |= (1 << (i & 7));
+    /* once running, only blocks known to be free are marked */
+    if (extents_ready)
+        extents_take(start, blocks);
+
+    bits_set(bitmap, start, blocks);
+}
+
+/* Copy a run of blocks which are all still to be dumped to the dump
+   binary, and mark them dumped.  Where the kernel can copy between files
+   itself (and perhaps share the blocks instead), it is left to do so. */
+static void dump_run(Int start, Int blocks)
+{
+    static char buf[DUMP_BUFFER];
+#ifdef HAVE_COPY_FILE_RANGE
+    static Int  in_kernel = 1;
+    loff_t      from, to;
+    ssize_t     copied;
+#endif
+    int         dump_fd = fileno(dump_db_file);
+    off_t       offset = BLOCK_OFFSET(start),
+                left = BLOCK_OFFSET(blocks);
+    Int         n;
+
+    bits_clear(dump_bitmap, start, blocks);
+
+#ifdef HAVE_COPY_FILE_RANGE
+    while (in_kernel && left > 0) {
+        from = to = offset;
+        copied = copy_file_range(database_fd, &from, dump_fd, &to, left, 0);
+        if (copied <= 0) {
+            /* not across these filesystems; the rest by hand, from now on */
+            if (copied < 0 && errno == EINTR)
+                continue;
+            in_kernel = 0;
+            break;
+        }
+        offset += copied;
+        left -= copied;
+    }
+#endif
+
+    while (left > 0) {
+        n = (left < DUMP_BUFFER) ? left : DUMP_BUFFER;
+        if (db_pread(database_fd, buf, n, offset) != n) {
+            UNLOCK_DB("dump_run")
+            panic("read(\"objects\"..): %s", strerror(errno));
+        }
+        if (db_pwrite(dump_fd, buf, n, offset) != n) {
+            UNLOCK_DB("dump_run")
+            panic("write(dump..): %s", strerror(errno));
+        }
+        offset += n;
+        left -= n;
+    }
 }
 
 /* This routine copies the object from the current binary to the
@@ -358,68 +1251,17 @@ static void simble_mark(off_t start, Int size)
 
 static void dump_copy (off_t start, Int blocks)
 {
-#if USE_OLD_DUMP_COPY
-    Int i;
-    char buf[BLOCK_SIZE];
-
-    /* check if we need to do this */
-    for (i=start; i<start+blocks; i++) {
-        if (i < dump_blocks && (bitmap[i >> 3] & (1 << (i&7))))
-            break;
-    }
-
-    if (i == start+blocks) return;
-
-    if (fseeko(database_file, BLOCK_OFFSET (start), SEEK_SET)) {
-        UNLOCK_DB("dump_copy")
-        panic("fseeko(\"%s\") in copy: %s", database_file, strerror(errno));
-    }
-
-    /* PORTABILITY WARNING : THIS FSEEK MAKES THE FILE LONGER IN SOME CASES.
-       Checked on Solaris, should work on others. */
+    Int b, run, end = start + blocks;
 
-    if (fseeko(dump_db_file,  BLOCK_OFFSET (start), SEEK_SET)) {
-        UNLOCK_DB("dump_copy")
-        panic("fseeko(\"%s\") in copy: %s", dump_db_file, strerror(errno));
-    }
-    for (i=0; i<blocks; i++) {
-        fread (buf, 1, BLOCK_SIZE, database_file);
-        fwrite (buf, 1, BLOCK_SIZE, dump_db_file);
-        dump_bitmap[(start+i) >> 3] &= ~(1 << ((start+i)&7));
-    }
-#else
-    off_t block = 0;
-    Int   dofseek = 1;
-    char  buf[BLOCK_SIZE];
-
-    block = start;
-    blocks += start;
-    if (blocks > dump_blocks)
-        blocks = dump_blocks;
-
-    while (block < blocks) {
-        if ( (dump_bitmap[block >> 3] & (1 << (block & 7))) ) {
-            if (dofseek) {
-                if (fseeko(database_file, BLOCK_OFFSET (block), SEEK_SET)) {
-                    UNLOCK_DB("dump_copy")
-                    panic("fseeko(\"%s\"..): %s", database_file, strerror(errno));
-                }
-                if (fseeko(dump_db_file,  BLOCK_OFFSET (block), SEEK_SET)) {
-                    UNLOCK_DB("dump_copy")
-                    panic("fseeko(\"%s\"..): %s", dump_db_file, strerror(errno));
-                }
-                dofseek=0;
-            }
-            fread (buf, 1, BLOCK_SIZE, database_file);
-            fwrite (buf, 1, BLOCK_SIZE, dump_db_file);
-            dump_bitmap[block >> 3] &= ~(1 << (block & 7));
-        }
-        else
-            dofseek=1;
+    if (end > dump_blocks)
+        end = dump_blocks;
 
-        ++block;
+    for (b = bits_next_set(dump_bitmap, start, end);
+         b < end;
+         b = bits_next_set(dump_bitmap, run, end)) {
+        run = bits_next_clear(dump_bitmap, b, end);
+        dump_run(b, run - b);
     }
-#endif
 }
 
 /* open the dump database. return -1 on failure (can't open the file),
@@ -433,11 +1275,26 @@ Int simble_dump_start(char *dump_objects_filename) {
         return -1;
     last_dumped = 0;
 
+    /* the dump is of the objects file as it will be once this is done */
+    writeback_drain();
+
     LOCK_DB("simble_dump_start")
 
+#ifdef FICLONE
+    /* A filesystem which can share blocks between files makes the dump a
+       copy-on-write snapshot, taken here and now: there is nothing left
+       to copy, before writes or from the main loop. */
+    if (ioctl(fileno(dump_db_file), FICLONE, database_fd) != F_FAILURE) {
+        dump_blocks = 0;
+        dump_bitmap = NULL;
+        UNLOCK_DB("simble_dump_start")
+        return 0;
+    }
+#endif
+
     dump_blocks = bitmap_blocks;
-    dump_bitmap = EMALLOC(char, (bitmap_blocks / 8)+1);
-    memcpy(dump_bitmap, bitmap, (bitmap_blocks / 8)+1);
+    dump_bitmap = EMALLOC(bitword, BITWORDS(bitmap_blocks));
+    memcpy(dump_bitmap, bitmap, BITWORDS(bitmap_blocks) * sizeof(bitword));
 
     UNLOCK_DB("simble_dump_start")
 
@@ -452,48 +1309,35 @@ Int simble_dump_start(char *dump_objects_filename) {
 
 Int simble_dump_some_blocks (Int maxblocks)
 {
-    Int dofseek = 1;
-    char buf[BLOCK_SIZE];
+    Int start, end;
 
     if (!dump_db_file)
         return DUMP_NOT_IN_PROGRESS;
 
     LOCK_DB("simble_dump_some_blocks")
 
-    while (maxblocks) {
-        if ( (dump_bitmap[last_dumped >> 3] & (1 << (last_dumped & 7))) ) {
-            if (dofseek) {
-                if (fseeko(database_file, BLOCK_OFFSET (last_dumped), SEEK_SET)) {
-                    UNLOCK_DB("simble_dump_some_blocks")
-                    panic("fseeko(\"%s\"..): %s", database_file, strerror(errno));
-                }
-                if (fseeko(dump_db_file,  BLOCK_OFFSET (last_dumped), SEEK_SET)) {
-                    UNLOCK_DB("simble_dump_some_blocks")
-                    panic("fseeko(\"%s\"..): %s", dump_db_file, strerror(errno));
-                }
-                dofseek=0;
-            }
-            fread (buf, 1, BLOCK_SIZE, database_file);
-            fwrite (buf, 1, BLOCK_SIZE, dump_db_file);
-            dump_bitmap[last_dumped >> 3] &= ~(1 << (last_dumped & 7));
-            maxblocks--;
-        }
-        else
-            dofseek=1;
-
-        if (last_dumped++ >= dump_blocks) {
-            if (fclose (dump_db_file)) {
-                UNLOCK_DB("simble_dump_some_blocks")
-                panic("Unable to close dump file '%s'", dump_db_file);
-            }
-            dump_db_file = NULL;
-            free (dump_bitmap);
-            dump_bitmap=NULL;
+    while (maxblocks > 0 && last_dumped < dump_blocks) {
+        start = bits_next_set(dump_bitmap, last_dumped, dump_blocks);
+        end = (maxblocks < dump_blocks - start) ? start + maxblocks : dump_blocks;
+        end = bits_next_clear(dump_bitmap, start, end);
+        if (end > start)
+            dump_run(start, end - start);
+        maxblocks -= end - start;
+        last_dumped = end;
+    }
 
+    if (last_dumped >= dump_blocks) {
+        if (fclose (dump_db_file)) {
             UNLOCK_DB("simble_dump_some_blocks")
-
-            return DUMP_FINISHED;
+            panic("Unable to close dump file: %s", strerror(errno));
         }
+        dump_db_file = NULL;
+        free (dump_bitmap);
+        dump_bitmap=NULL;
+
+        UNLOCK_DB("simble_dump_some_blocks")
+
+        return DUMP_FINISHED;
     }
 
     UNLOCK_DB("simble_dump_some_blocks")
@@ -503,82 +1347,122 @@ Int simble_dump_some_blocks (Int maxblocks)
 
 static void simble_unmark(off_t start, Int size)
 {
-    Int i, blocks;
+    Int blocks, b, end;
 
-    blocks = NEEDED(size, BLOCK_SIZE);
+    blocks = NEEDED(size, block_size);
     allocated_blocks-=blocks;
 
     if (dump_db_file) dump_copy (start, blocks);
 
-    /* Remember a free block was here. */
-    last_free = start;
-
-    for (i = start; i < start + blocks; i++)
-        bitmap[i >> 3] &= ~(1 << (i & 7));
+    /* hand back only what was really in use, whatever the index said */
+    for (b = bits_next_set(bitmap, start, start + blocks);
+         b < start + blocks;
+         b = bits_next_set(bitmap, end, start + blocks)) {
+        end = bits_next_clear(bitmap, b, start + blocks);
+        bits_clear(bitmap, b, end - b);
+        extents_free(b, end - b);
+    }
 }
 
 static Int simble_alloc(Int size)
 {
-    Int blocks_needed, b, count, starting_block, over_the_top;
+    Int      blocks_needed, start;
+    extent * e;
 
-    b = last_free;
-    blocks_needed = NEEDED(size, BLOCK_SIZE);
-#ifdef BUILDING_COLDCC
-    over_the_top = 1;
-#else
-    over_the_top = 0;
-#endif
+    blocks_needed = NEEDED(size, block_size);
 
-    for (;;) {
+    while (!(e = extents_fit(blocks_needed)))
+        simble_grow_bitmap(bitmap_blocks + ROUND_UP(blocks_needed, DB_BITBLOCK));
 
-        if (b < bitmap_blocks && bitmap[b >> 3] == (char)255) {
-            /* 8 full blocks. Let's run away from this! */
-            b = (b & ~7) + 8;
-            while (b < bitmap_blocks && bitmap[b >> 3] == (char)255) {
-                b += 8;
-            }
-        }
+    start = e->start;
+    extents_take(start, blocks_needed);
 
-        if (b >= bitmap_blocks) {
-            /* Only wrap around once. */
-            if (!over_the_top) {
-                b = 0;
-                over_the_top = 1;
-                continue;
-            } else {
-                simble_grow_bitmap(b + DB_BITBLOCK);
-            }
-        }
+    /* Mark these blocks taken and return the starting block. */
+    allocated_blocks += blocks_needed;
+    bits_set(bitmap, start, blocks_needed);
 
-        starting_block = b;
-
-        for (count = 0; count < blocks_needed; count++) {
-            if (bitmap[b >> 3] & (1 << (b & 7)))
-                break;
-            b++;
-            if (b >= bitmap_blocks) {
-                /* time to wrap around if we still haven't */
-                if (!over_the_top) {
-                    b = 0;
-                    over_the_top = 1;
-                    break;
-                } else {
-                    simble_grow_bitmap(b + ROUND_UP(blocks_needed-count, DB_BITBLOCK));
-                }
-            }
-        }
+    return start;
+}
 
-        if (count == blocks_needed) {
-            /* Mark these blocks taken and return the starting block. */
-            allocated_blocks+=count;
-            for (b = starting_block; b < starting_block + count; b++)
-                bitmap[b >> 3] |= (1 << (b & 7));
-            last_free = b;
-            return starting_block;
-        }
+/*
+// -------------------------------------------------------------------------
+// Ask the kernel to start reading objects which are about to be wanted,
+// such as the parents of one just loaded, so that a cold method search
+// does not wait on one seek per ancestor.  The extents are sorted by
+// offset and those less than PREFETCH_GAP apart merged into one request.
+// Objects held in the log or the writeback queue are skipped, they are
+// read from memory.
+*/
+
+#define PREFETCH_MAX        64          /* Objects advised at once */
+#define PREFETCH_GAP        16384       /* Bytes between merged extents */
+
+typedef struct {
+    off_t offset;
+    off_t end;
+} prefetch_t;
+
+static int prefetch_cmp(const void * a, const void * b) {
+    off_t x = ((const prefetch_t *) a)->offset,
+          y = ((const prefetch_t *) b)->offset;
+
+    return (x > y) - (x < y);
+}
+
+static void prefetch_extent(off_t offset, off_t end) {
+#ifdef USE_MMAP_OBJECTS
+    static long page = 0;
+
+    if (end <= map_len) {
+        if (!page)
+            page = sysconf(_SC_PAGESIZE);
+        offset -= offset % page;
+        madvise(map_buf->s + offset, end - offset, MADV_WILLNEED);
+        return;
+    }
+#endif
+#ifdef HAVE_POSIX_FADVISE
+    posix_fadvise(database_fd, offset, end - offset, POSIX_FADV_WILLNEED);
+#endif
+}
 
-        b++;
+void simble_prefetch(cObjnum * objnums, Int count)
+{
+    prefetch_t   ext[PREFETCH_MAX];
+    off_t        offset, end;
+    Int          i, j, n, size;
+
+    for (i = n = 0; i < count && n < PREFETCH_MAX; i++) {
+#ifdef USE_OBJECT_LOG
+        if (log_entry(objnums[i]))
+            continue;
+#endif
+#ifdef USE_WRITEBACK_THREAD
+        if (writeback_find(objnums[i]))
+            continue;
+#endif
+        if (!lookup_retrieve_objnum(objnums[i], &offset, &size))
+            continue;
+        ext[n].offset = offset;
+        ext[n].end = offset + size;
+        n++;
     }
+
+    if (!n)
+        return;
+
+    qsort(ext, n, sizeof(prefetch_t), prefetch_cmp);
+
+    LOCK_DB("simble_prefetch")
+    for (i = 0; i < n; i = j) {
+        end = ext[i].end;
+        for (j = i + 1; j < n && ext[j].offset < end + PREFETCH_GAP; j++) {
+            if (ext[j].end > end)
+                end = ext[j].end;
+        }
+        prefetch_extent(ext[i].offset, end);
+    }
+    UNLOCK_DB("simble_prefetch")
 }
 
 Int simble_get(Obj *object, cObjnum objnum, Long *sizeread)
@@ -591,23 +1475,46 @@ Int simble_get(Obj *object, cObjnum objnum, Long *sizeread)
     if (sizeread)
         *sizeread = -1;
 
+#ifdef USE_OBJECT_LOG
+    /* a newer copy which hasn't been folded into the objects file yet */
+    if (log_entry(objnum))
+        return log_get(object, log_entry(objnum), sizeread);
+#endif
+
     /* Get the object location for the objnum. */
     if (!lookup_retrieve_objnum(objnum, &offset, &size))
         return 0;
 
-    LOCK_DB("simble_get")
+    if (sizeread)
+        *sizeread = size;
+
+#ifdef USE_WRITEBACK_THREAD
+    /* its blocks may not be written yet */
+    if ((buf = writeback_find(objnum))) {
+        buf_pos = 0;
+        unpack_object(buf, &buf_pos, object);
+        return 1;
+    }
+#endif
 
-    /* seek to location */
-    if (fseeko(database_file, offset, SEEK_SET)) {
+#ifdef USE_MMAP_OBJECTS
+    /* decode in place; objects written past the end of the mapping since
+       it was made are picked up by extending it */
+    LOCK_DB("simble_get")
+    if (offset + size <= map_len || db_extend(offset + size)) {
+        buf_pos = offset;
+        unpack_object(map_buf, &buf_pos, object);
         UNLOCK_DB("simble_get")
-        return 0;
+        return 1;
     }
+    UNLOCK_DB("simble_get")
+#endif
 
-    if (sizeread)
-        *sizeread = size;
     buf = buffer_new(size);
     buf->len = size;
-    buf_pos = fread(buf->s, sizeof(uChar), size, database_file);
+
+    LOCK_DB("simble_get")
+    buf_pos = db_pread(database_fd, buf->s, size, offset);
     UNLOCK_DB("simble_get")
     if (buf_pos != size)
         panic("simble_get: only read %d of %d bytes.", buf_pos, size);
@@ -621,45 +1528,42 @@ Int simble_get(Obj *object, cObjnum objnum, Long *sizeread)
 
 static Int check_free_blocks(Int blocks_needed, Int b)
 {
-    Int count;
-
-    if (b >= bitmap_blocks)
+    if (b + blocks_needed > bitmap_blocks)
         return 0;
-    for (count = 0; count < blocks_needed; count++) {
-        if (bitmap[b >> 3] & (1 << (b & 7)))
-            break;
-        b++;
-        if (b >= bitmap_blocks)
-            break;
-    }
-    return count == blocks_needed;
+    return bits_next_set(bitmap, b, b + blocks_needed) == b + blocks_needed;
 }
 
-Int simble_put(Obj *obj, cObjnum objnum, Long *sizewritten)
+/* pad a packed object out to a whole number of blocks */
+static cBuf * pad_object(cBuf * buf)
+{
+    if (buf->len % block_size)
+        buf = buffer_append_uchars_single_ref(buf, (uChar *) pad_string->s,
+                                              block_size - (buf->len % block_size));
+    return buf;
+}
+
+/* Write a packed, padded object to its place in the objects file, moving
+   it if it has outgrown its blocks.  Consumes buf. */
+static Int simble_write(cBuf *buf, cObjnum objnum, Long *sizewritten)
 {
-    cBuf *buf;
     off_t old_offset, new_offset;
     Int old_size, new_size, tmp1, tmp2;
 
-    old_offset = -1;
-    if (lookup_retrieve_objnum(objnum, &old_offset, &old_size)) {
-        buf = buffer_new(old_size);
-        buf = pack_object(buf, obj);
-        if (buf->len % BLOCK_SIZE)
-            buf = buffer_append_uchars_single_ref(buf, (uChar*)pad_string->s, 256 - (buf->len % BLOCK_SIZE));
-        new_size = buf->len;
+    new_size = buf->len;
 
-        LOCK_DB("simble_put")
-        simble_flag_as_dirty();
+    LOCK_DB("simble_write")
+    simble_flag_as_dirty();
 
-        if ((tmp1=NEEDED(new_size, BLOCK_SIZE)) > (tmp2=NEEDED(old_size, BLOCK_SIZE))) {
+    old_offset = -1;
+    if (lookup_retrieve_objnum(objnum, &old_offset, &old_size)) {
+        if ((tmp1=NEEDED(new_size, block_size)) > (tmp2=NEEDED(old_size, block_size))) {
             /* check for the possible realloc */
             if (check_free_blocks(tmp1 - tmp2, LOGICAL_BLOCK(old_offset)+tmp2)) {
                 /* no, we don't have to move, just overwrite */
                 if (dump_db_file)
                     dump_copy (LOGICAL_BLOCK(old_offset), tmp1);
                 simble_mark(LOGICAL_BLOCK(old_offset) + tmp2,
-                        BLOCK_SIZE * (tmp1 - tmp2));
+                        block_size * (tmp1 - tmp2));
                 new_offset = old_offset;
             } else {
                 simble_unmark(LOGICAL_BLOCK(old_offset), old_size);
@@ -670,21 +1574,11 @@ Int simble_put(Obj *obj, cObjnum objnum, Long *sizewritten)
                 dump_copy (LOGICAL_BLOCK(old_offset), tmp2);
             if (tmp1 < tmp2) {
                 simble_unmark(LOGICAL_BLOCK(old_offset) + tmp1,
-                          BLOCK_SIZE * (tmp2 - tmp1));
+                          block_size * (tmp2 - tmp1));
             }
             new_offset = old_offset;
         }
     } else {
-        ++num_objects;
-        buf = buffer_new(0);
-        buf = pack_object(buf, obj);
-        if (buf->len % BLOCK_SIZE)
-            buf = buffer_append_uchars_single_ref(buf, (uChar*)pad_string->s, 256 - (buf->len % BLOCK_SIZE));
-        new_size = buf->len;
-
-        LOCK_DB("simble_put")
-        simble_flag_as_dirty();
-
         new_offset = BLOCK_OFFSET((off_t)simble_alloc(new_size));
     }
 
@@ -692,25 +1586,25 @@ Int simble_put(Obj *obj, cObjnum objnum, Long *sizewritten)
     if ((new_offset != old_offset) ||
       (new_size   != old_size)) {
         if (!lookup_store_objnum(objnum, new_offset, new_size)) {
-            UNLOCK_DB("simble_put")
+            UNLOCK_DB("simble_write")
             buffer_discard(buf);
             if (sizewritten) *sizewritten = 0;
             return 0;
         }
     }
 
-    if (fseeko(database_file, new_offset, SEEK_SET)) {
-        UNLOCK_DB("simble_put")
-        buffer_discard(buf);
-        write_err("ERROR: Seek failed for %l.", objnum);
-        if (sizewritten) *sizewritten = 0;
-        return 0;
+#ifdef USE_WRITEBACK_THREAD
+    if (wb_running) {
+        UNLOCK_DB("simble_write")
+        writeback_queue(buf, objnum, new_offset);
+        if (sizewritten) *sizewritten = new_size;
+        return 1;
     }
+#endif
 
-    old_size = fwrite(buf->s, sizeof(uChar), new_size, database_file);
+    old_size = db_pwrite(database_fd, buf->s, new_size, new_offset);
     buffer_discard(buf);
-    fflush(database_file);
-    UNLOCK_DB("simble_put")
+    UNLOCK_DB("simble_write")
     if (old_size != new_size)
         panic("simble_put: only wrote %d of %d bytes.", old_size, new_size);
 
@@ -719,15 +1613,41 @@ Int simble_put(Obj *obj, cObjnum objnum, Long *sizewritten)
     return 1;
 }
 
+Int simble_put(Obj *obj, cObjnum objnum, Long *sizewritten)
+{
+#ifdef USE_OBJECT_LOG
+    return log_put(obj, objnum, sizewritten);
+#else
+    cBuf *buf;
+    off_t offset;
+    Int size;
+
+    if (lookup_retrieve_objnum(objnum, &offset, &size)) {
+        buf = buffer_new(size);
+    } else {
+        ++num_objects;
+        buf = buffer_new(0);
+    }
+    buf = pad_object(pack_object(buf, obj));
+
+    return simble_write(buf, objnum, sizewritten);
+#endif
+}
+
 Int simble_check(cObjnum objnum)
 {
     off_t offset;
     Int size;
 
+#ifdef USE_OBJECT_LOG
+    if (log_entry(objnum))
+        return log_entry(objnum) > 0;
+#endif
     return lookup_retrieve_objnum(objnum, &offset, &size);
 }
 
-Int simble_del(cObjnum objnum)
+/* Remove an object from the index and the objects file. */
+static Int simble_erase(cObjnum objnum)
 {
     off_t offset;
     Int size;
@@ -741,40 +1661,760 @@ Int simble_del(cObjnum objnum)
     if (!lookup_remove_objnum(objnum))
         return 0;
 
-    LOCK_DB("simble_del")
+    LOCK_DB("simble_erase")
 
-    --num_objects;
     simble_flag_as_dirty();
 
     /* Mark free space in bitmap */
     simble_unmark(LOGICAL_BLOCK(offset), size);
 
     /* Mark object dead in file */
-    if (fseeko(database_file, offset, SEEK_SET)) {
-        write_err("ERROR: Failed to seek to object %l.", objnum);
+    buf = buffer_new(size);
+    buf->len = size;
+    memset(buf->s, 0, size);
+#ifdef USE_WRITEBACK_THREAD
+    if (wb_running) {
+        writeback_queue(buf, objnum, offset);
+        UNLOCK_DB("simble_erase")
+        return 1;
+    }
+#endif
+    if (db_pwrite(database_fd, buf->s, size, offset) != size)
+        write_err("ERROR: Failed to clear object %l.", objnum);
+    buffer_discard(buf);
 
-        UNLOCK_DB("simble_del")
+    UNLOCK_DB("simble_erase")
+
+    return 1;
+}
 
+Int simble_del(cObjnum objnum)
+{
+#ifdef USE_OBJECT_LOG
+    return log_del(objnum);
+#else
+    if (!simble_erase(objnum))
         return 0;
-    }
+    --num_objects;
+    return 1;
+#endif
+}
+
+/*
+// -------------------------------------------------------------------------
+// Online compaction.  simble_compact() is called from the main loop like
+// simble_dump_some_blocks().  Once enough of the objects file is free
+// space below its last object, it starts a pass over the objects in
+// objnum order.  Each object lying past the point where the file would end
+// if it were packed is moved to the lowest free space which holds it.
+// When the pass is done the free tail of the file is truncated.  Moves
+// open up room for objects which did not fit anywhere before, so passes
+// are repeated for as long as they get anything done.
+//
+// A move copies the object, then points the index at the new copy, and
+// only then frees the old one.  With the object log, whatever is on disk
+// has to stay loadable, so the old copies are kept until the objects file
+// and the index have been synced.
+*/
+
+/* the free blocks below the end of the last object, which it sets *end to */
+static Int compact_holes(Int * end) {
+    extent * e = tree_floor(bitmap_blocks - 1);
+
+    if (e && e->start + e->blocks == bitmap_blocks)
+        *end = e->start;
+    else
+        *end = bitmap_blocks;
+    return (*end > allocated_blocks) ? *end - allocated_blocks : 0;
+}
+
+/* Move objnum down if it is past compact_target and there is room for it
+   lower down.  Returns the work done, in blocks. */
+static Int compact_object(cObjnum objnum) {
+    off_t    offset;
+    Int      size, start, blocks;
+    extent * e;
+    cBuf   * buf;
+
+#ifdef USE_OBJECT_LOG
+    /* its latest copy is in the log; folding it will place it */
+    if (log_entry(objnum))
+        return 1;
+#endif
+    if (!lookup_retrieve_objnum(objnum, &offset, &size))
+        return 1;
+
+    start = LOGICAL_BLOCK(offset);
+    blocks = NEEDED(size, block_size);
+    if (start + blocks <= compact_target)
+        return 1;
+    e = tree_lowest_fit(blocks);
+    if (!e || e->start >= start)
+        return 1;
 
     buf = buffer_new(size);
-    buf->len = size;
-    memset(buf->s, 0, size);
-    fwrite(buf->s, sizeof(uChar), size, database_file);
+    if (db_pread(database_fd, buf->s, size, offset) != size) {
+        UNLOCK_DB("compact_object")
+        panic("compact_object: unable to read object %l: %s",
+              objnum, strerror(errno));
+    }
+
+    simble_flag_as_dirty();
+    start = e->start;
+    simble_mark(start, size);
+    if (db_pwrite(database_fd, buf->s, size, BLOCK_OFFSET((off_t) start)) != size) {
+        UNLOCK_DB("compact_object")
+        panic("compact_object: unable to write object %l: %s",
+              objnum, strerror(errno));
+    }
+    buffer_discard(buf);
+
+    if (!lookup_store_objnum(objnum, BLOCK_OFFSET((off_t) start), size)) {
+        simble_unmark(start, size);
+        return blocks;
+    }
+    compact_moved++;
+
+#ifdef USE_OBJECT_LOG
+    if (compact_freed_count + 2 > compact_freed_size) {
+        compact_freed_size = compact_freed_size ? compact_freed_size * 2 : 64;
+        compact_freed = EREALLOC(compact_freed, Int, compact_freed_size);
+    }
+    compact_freed[compact_freed_count++] = LOGICAL_BLOCK(offset);
+    compact_freed[compact_freed_count++] = size;
+#else
+    simble_unmark(LOGICAL_BLOCK(offset), size);
+#endif
+
+    return blocks;
+}
+
+/* give the free space at the end of the objects file back */
+static void compact_truncate(void) {
+    struct stat statbuf;
+    extent    * e = tree_floor(bitmap_blocks - 1);
+    Int         end;
+
+    if (!e || e->start + e->blocks != bitmap_blocks)
+        return;
+    end = e->start ? ROUND_UP(e->start, WORD_BITS) : 0;
+    if (end >= bitmap_blocks)
+        return;
+
+    if (end == e->start)
+        extent_del(e);
+    else
+        extent_resize(e, e->start, end - e->start);
+    bitmap = EREALLOC(bitmap, bitword, BITWORDS(end) ? BITWORDS(end) : 1);
+    bitmap_blocks = end;
+
+    if (fstat(database_fd, &statbuf) == F_FAILURE ||
+        statbuf.st_size <= BLOCK_OFFSET((off_t) end))
+        return;
+#ifdef USE_MMAP_OBJECTS
+    /* simble_get() maps it again as it needs to */
+    db_unmap();
+#endif
+    if (ftruncate(database_fd, BLOCK_OFFSET((off_t) end)) == F_FAILURE)
+        write_err("ERROR: Unable to truncate object database: %s",
+                  strerror(errno));
+}
+
+/* Move up to about maxblocks blocks worth of objects.  Returns nonzero
+   while a pass is in progress.  Nothing is done while dumping. */
+Int simble_compact(Int maxblocks)
+{
+    Int end, holes;
+
+    if (maxblocks <= 0 || dump_db_file || !extents_ready)
+        return 0;
+
+    LOCK_DB("simble_compact")
+
+    if (!compacting) {
+        holes = compact_holes(&end);
+        if (holes < compact_after)
+            compact_after = holes;
+        /* after a pass which moved nothing, wait until there is more to
+           win than it had to leave behind */
+        if (holes < compact_after + COMPACT_MIN_BLOCKS ||
+            (Float) holes / (Float) end * 100 < COMPACT_THRESHOLD) {
+            UNLOCK_DB("simble_compact")
+            return 0;
+        }
+        compacting = 1;
+        compact_next = 0;
+        compact_target = allocated_blocks;
+        compact_moved = 0;
+    }
+
+    /* objects are copied straight from the file */
+    writeback_drain();
+
+    while (maxblocks > 0 && compact_next < db_top)
+        maxblocks -= compact_object(compact_next++);
+
+#ifdef USE_OBJECT_LOG
+    if (compact_freed_count) {
+        if (fsync(database_fd) == F_FAILURE)
+            write_err("ERROR: Unable to sync object database: %s", strerror(errno));
+        lookup_sync();
+        while (compact_freed_count) {
+            compact_freed_count -= 2;
+            simble_unmark(compact_freed[compact_freed_count],
+                          compact_freed[compact_freed_count + 1]);
+        }
+    }
+#endif
+
+    if (compact_next >= db_top) {
+        compacting = 0;
+        compact_truncate();
+        compact_after = compact_moved ? 0 : compact_holes(&end);
+    }
+
+    UNLOCK_DB("simble_compact")
+
+    return compacting;
+}
+
+/*
+// -------------------------------------------------------------------------
+// Rewrite the objects file with another block size, for coldcc.  Each
+// object is read in through the cache and packed into objects.new, one
+// after the other.  The old files are left alone until objects.new, the
+// index for it (index.objnum.new) and its .clean (.clean.new) are all on
+// disk.  Then objects.old is linked to the old objects file and the new
+// files are renamed into place; objects.old goes last.  If objects.old is
+// still there at startup, simble_recover_reblock() puts the old files
+// back when index.objnum.new is left, and otherwise finishes the job.
+*/
+void simble_reblock(Int new_size)
+{
+    struct stat   statbuf;
+    char          fdb_objects[BUF],
+                  fdb_new[BUF],
+                  fdb_old[BUF],
+                  clean_new[sizeof(c_clean_file) + 4];
+    FILE        * fp;
+    off_t       * offsets,
+                  offset,
+                  end = 0;
+    Int         * sizes,
+                  size;
+    int           fd;
+    cObjnum       objnum;
+    Obj         * obj;
+    cBuf        * buf;
+
+#ifdef USE_OBJECT_LOG
+    log_commit();
+    while (simble_checkpoint(CHECKPOINT_RECORDS));
+#endif
+    cache_sync();
+
+    DBFILE(fdb_objects, "objects");
+    DBFILE(fdb_new,     "objects.new");
+    DBFILE(fdb_old,     "objects.old");
+    sprintf(clean_new, "%s.new", c_clean_file);
+    fd = open(fdb_new, O_RDWR | O_CREAT | O_TRUNC | O_BINARY, READ_WRITE);
+    if (fd == F_FAILURE)
+        FAIL("Cannot create object database file \"%s/objects.new\".\n");
+
+    offsets = EMALLOC(off_t, db_top + 1);
+    sizes = EMALLOC(Int, db_top + 1);
+    for (objnum = 0; objnum < db_top; objnum++) {
+        sizes[objnum] = 0;
+        if (!lookup_retrieve_objnum(objnum, &offset, &size))
+            continue;
+        if (!(obj = cache_retrieve(objnum)))
+            panic("simble_reblock: unable to load object %l.", objnum);
+        buf = pack_object(buffer_new(0), obj);
+        cache_discard(obj);
+
+        /* the padding is left as a hole, which reads back as zeros */
+        if (db_pwrite(fd, buf->s, buf->len, end) != buf->len)
+            FAIL("Cannot write object database file \"%s/objects.new\".\n");
+        offsets[objnum] = end;
+        sizes[objnum] = NEEDED(buf->len, new_size) * new_size;
+        end += sizes[objnum];
+        buffer_discard(buf);
+    }
+    if (ftruncate(fd, end) == F_FAILURE || fsync(fd) == F_FAILURE)
+        FAIL("Cannot write object database file \"%s/objects.new\".\n");
+
+    for (objnum = 0; objnum < db_top; objnum++) {
+        if (sizes[objnum] &&
+            !lookup_store_objnum(objnum, offsets[objnum], sizes[objnum]))
+            panic("simble_reblock: unable to index object %l.", objnum);
+    }
+    efree(offsets);
+    efree(sizes);
+    if (!lookup_stage_objnums())
+        FAIL("Cannot write objnum index file \"%s/index.objnum.new\".\n");
+
+    block_size = new_size;
+    fp = open_scratch_file(clean_new, "wb");
+    if (!fp)
+        FAIL("Cannot create file \"%s/.clean.new\".\n");
+    write_clean_file(fp);
+    close_scratch_file(fp);
+
+    /* everything is on disk; swap the files over */
+    unlink(fdb_old);
+    if (link(fdb_objects, fdb_old) == F_FAILURE)
+        FAIL("Cannot link object database file \"%s/objects.old\".\n");
+#ifdef USE_MMAP_OBJECTS
+    db_unmap();
+#endif
+    close(database_fd);
+    if (rename(fdb_new, fdb_objects) == F_FAILURE)
+        FAIL("Cannot replace object database file \"%s/objects\".\n");
+    database_fd = fd;
+    if (!lookup_commit_objnums())
+        FAIL("Cannot replace objnum index file \"%s/index.objnum\".\n");
+    if (rename(clean_new, c_clean_file) == F_FAILURE)
+        FAIL("Cannot replace file \"%s/.clean\".\n");
+    db_clean = 1;
+    unlink(fdb_old);
+
+    string_discard(pad_string);
+    pad_string = string_of_char(0, block_size);
+
+    /* and the free space, which is now only at the end */
+    simble_free_extents();
+    efree(bitmap);
+    num_objects = 0;
+    init_bitmaps();
+    sync_index();
+    simble_init_extents();
+#ifdef USE_MMAP_OBJECTS
+    db_remap();
+#endif
+
+    lookup_sync();
+    fprintf(errfile, "[%s] Rewrote binary database with %d byte blocks\n",
+            timestamp(NULL), block_size);
+}
+
+#ifdef USE_OBJECT_LOG
+/*
+// -------------------------------------------------------------------------
+// The object log.  With USE_OBJECT_LOG every simble_put() and simble_del()
+// just appends a record to binary/log; simble_flush() appends a commit mark
+// and fsyncs the log, and that is all a sync costs.  simble_checkpoint(),
+// run from the main loop, later folds committed records into the objects
+// file and the index through the ordinary write path.
+//
+// Evicting a dirty object appends a record between syncs, so on a busy
+// server the log is never all folded at once.  Instead each commit renames
+// the log to log.old, unless an older one is still being folded, and
+// starts a new one.  log.old is removed once it has all been folded and
+// the objects file and index are synced.  Entries for records in log.old
+// carry LOG_OLD.
+//
+// Only objects which have a record in the log are ever written to the
+// objects file, so whatever state a crash leaves the objects file and index
+// in, replaying the committed records over them gives back the database
+// as of the last commit.  log_replay() does that at startup, simply by
+// rebuilding log_index; the records are folded in as usual afterwards.
+*/
+
+#define LOG_OLD         ((off_t) 1 << (sizeof(off_t) * 8 - 2))
+#define LOG_OFFSET(e)   (((e) & (LOG_OLD - 1)) - 1)
+
+/* 0 if the latest copy of objnum is in the objects file (or nowhere),
+   otherwise 1 + the offset of its newest record, with LOG_OLD if that is
+   in log.old, negated for a deletion */
+static off_t log_entry(cObjnum objnum) {
+    if (objnum < 0 || objnum >= log_index_size)
+        return 0;
+    return log_index[objnum];
+}
+
+static void log_set_entry(cObjnum objnum, off_t entry) {
+    cObjnum size;
+
+    if (objnum >= log_index_size) {
+        size = log_index_size ? log_index_size : 1024;
+        while (size <= objnum)
+            size *= 2;
+        log_index = EREALLOC(log_index, off_t, size);
+        memset(log_index + log_index_size, 0,
+               (size - log_index_size) * sizeof(off_t));
+        log_index_size = size;
+    }
+    log_index[objnum] = entry;
+}
+
+static uLong log_checksum(log_header * hdr, uChar * s, Long len) {
+    uLong sum = (uLong) hdr->objnum * 31 + (uLong) hdr->size;
+
+    while (len-- > 0)
+        sum = sum * 31 + *s++;
+    return sum;
+}
+
+static void log_append(cObjnum objnum, uChar * s, Long size) {
+    log_header hdr;
+    Long       len = (size > 0) ? size : 0;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.objnum = objnum;
+    hdr.size = size;
+    hdr.check = log_checksum(&hdr, s, len);
+    if (db_pwrite(log_fd, &hdr, sizeof(hdr), log_end) != sizeof(hdr) ||
+        db_pwrite(log_fd, s, len, log_end + sizeof(hdr)) != len) {
+        UNLOCK_DB("log_append")
+        panic("Cannot write to object log: %s", strerror(errno));
+    }
+    log_end += sizeof(hdr) + len;
+}
+
+/* read the record at offset rec; returns a buffer of its packed object
+   (or NULL for a deletion) and sets *next to the offset following it, or
+   returns NULL and sets *next to -1 if the record is torn or bad */
+static cBuf * log_read(int fd, off_t rec, log_header * hdr, off_t * next) {
+    cBuf * buf = NULL;
+
+    *next = -1;
+    if (db_pread(fd, hdr, sizeof(*hdr), rec) != sizeof(*hdr) ||
+        hdr->size < -1)
+        return NULL;
+    if (hdr->size > 0) {
+        buf = buffer_new(hdr->size);
+        buf->len = hdr->size;
+        if (db_pread(fd, buf->s, hdr->size, rec + sizeof(*hdr)) != hdr->size) {
+            buffer_discard(buf);
+            return NULL;
+        }
+    }
+    if (log_checksum(hdr, buf ? buf->s : NULL, buf ? buf->len : 0) != hdr->check) {
+        if (buf)
+            buffer_discard(buf);
+        return NULL;
+    }
+    *next = rec + sizeof(*hdr) + (buf ? buf->len : 0);
+    return buf;
+}
+
+static void log_open(char *name, Int cnew) {
+    strcpy(log_name, name);
+    sprintf(old_name, "%s.old", name);
+    if (cnew)
+        unlink(old_name);
+
+    log_fd = open(name, O_RDWR | O_CREAT | O_BINARY | (cnew ? O_TRUNC : 0),
+                  READ_WRITE);
+    if (log_fd == F_FAILURE)
+        FAIL("Cannot open object log \"%s/log\".\n");
+    log_end = log_committed = log_folded = 0;
+    log_pending = 0;
+    old_fd = -1;
+    old_end = old_folded = 0;
+}
+
+/* index the committed records of one log file, returning how many there
+   are and setting *committed to the end of its last commit mark */
+static Long log_scan(int fd, off_t tag, off_t * committed) {
+    log_header hdr;
+    cBuf     * buf;
+    off_t      rec, next;
+    Long       records = 0;
+    off_t      offset;
+    Int        size, existed;
+
+    /* find the end of the last commit mark; anything after it is from a
+       sync which never finished */
+    *committed = 0;
+    for (rec = 0; ; rec = next) {
+        buf = log_read(fd, rec, &hdr, &next);
+        if (buf)
+            buffer_discard(buf);
+        if (next == -1)
+            break;
+        if (hdr.objnum == INV_OBJNUM)
+            *committed = next;
+    }
+
+    for (rec = 0; rec < *committed; rec = next) {
+        buf = log_read(fd, rec, &hdr, &next);
+        if (buf)
+            buffer_discard(buf);
+        if (hdr.objnum == INV_OBJNUM)
+            continue;
+
+        if (log_entry(hdr.objnum))
+            existed = log_entry(hdr.objnum) > 0;
+        else
+            existed = lookup_retrieve_objnum(hdr.objnum, &offset, &size);
+
+        if (hdr.size == -1) {
+            if (existed)
+                --num_objects;
+            log_set_entry(hdr.objnum, -(tag | (rec + 1)));
+        } else {
+            if (!existed)
+                ++num_objects;
+            if (hdr.objnum >= db_top)
+                db_top = hdr.objnum + 1;
+            log_set_entry(hdr.objnum, tag | (rec + 1));
+        }
+        records++;
+    }
+
+    return records;
+}
+
+static void log_replay(void) {
+    Long records = 0;
+
+    /* log.old holds the older records, so it goes first */
+    old_fd = open(old_name, O_RDWR | O_BINARY);
+    if (old_fd != F_FAILURE) {
+        records += log_scan(old_fd, LOG_OLD, &old_end);
+        if (!old_end) {
+            close(old_fd);
+            unlink(old_name);
+            old_fd = -1;
+        }
+    }
+
+    records += log_scan(log_fd, 0, &log_committed);
+    if (ftruncate(log_fd, log_committed) == F_FAILURE)
+        FAIL("Cannot truncate object log \"%s/log\".\n");
+    log_end = log_committed;
+
+    if (records)
+        fprintf(errfile, "[%s] Recovered %ld object log records\n",
+                timestamp(NULL), (long) records);
+}
+
+static Int log_get(Obj *object, off_t rec, Long *sizeread) {
+    log_header hdr;
+    cBuf     * buf;
+    off_t      next;
+    Long       buf_pos;
+
+    if (rec < 0)
+        return 0;
+
+    LOCK_DB("log_get")
+    buf = log_read((rec & LOG_OLD) ? old_fd : log_fd, LOG_OFFSET(rec), &hdr, &next);
+    UNLOCK_DB("log_get")
+    if (!buf)
+        panic("simble_get: bad object log record at %ld.", (long) LOG_OFFSET(rec));
+
+    if (sizeread)
+        *sizeread = buf->len;
+    buf_pos = 0;
+    unpack_object(buf, &buf_pos, object);
     buffer_discard(buf);
-    fflush(database_file);
 
-    UNLOCK_DB("simble_del")
+    return 1;
+}
+
+static Int log_put(Obj *obj, cObjnum objnum, Long *sizewritten) {
+    cBuf * buf;
+
+    buf = pack_object(buffer_new(0), obj);
+
+    LOCK_DB("log_put")
+    if (!simble_check(objnum))
+        ++num_objects;
+    log_set_entry(objnum, log_end + 1);
+    log_append(objnum, buf->s, buf->len);
+    log_pending++;
+    UNLOCK_DB("log_put")
+
+    if (sizewritten) *sizewritten = buf->len;
+    buffer_discard(buf);
+
+    return 1;
+}
+
+static Int log_del(cObjnum objnum) {
+    if (!simble_check(objnum))
+        return 0;
+
+    LOCK_DB("log_del")
+    --num_objects;
+    log_set_entry(objnum, -(log_end + 1));
+    log_append(objnum, NULL, -1);
+    log_pending++;
+    UNLOCK_DB("log_del")
 
     return 1;
 }
 
+/* start a new log, the committed one becoming log.old; every entry for
+   it is moved over to LOG_OLD */
+static void log_rotate(void) {
+    cObjnum i;
+
+    if (rename(log_name, old_name) == F_FAILURE) {
+        write_err("ERROR: Unable to rename object log: %s", strerror(errno));
+        return;
+    }
+    old_fd = log_fd;
+    old_end = log_end;
+    old_folded = log_folded;
+
+    log_fd = open(log_name, O_RDWR | O_CREAT | O_TRUNC | O_BINARY, READ_WRITE);
+    if (log_fd == F_FAILURE) {
+        UNLOCK_DB("log_rotate")
+        panic("Cannot create object log: %s", strerror(errno));
+    }
+    log_end = log_committed = log_folded = 0;
+
+    for (i = 0; i < log_index_size; i++) {
+        if (log_index[i] > 0)
+            log_index[i] |= LOG_OLD;
+        else if (log_index[i] < 0)
+            log_index[i] = -(-log_index[i] | LOG_OLD);
+    }
+}
+
+static void log_commit(void) {
+    LOCK_DB("log_commit")
+    if (log_pending) {
+        log_append(INV_OBJNUM, NULL, 0);
+        if (fsync(log_fd) == F_FAILURE)
+            write_err("ERROR: Unable to sync object log: %s", strerror(errno));
+        log_committed = log_end;
+        log_pending = 0;
+        if (old_fd == -1)
+            log_rotate();
+    }
+    UNLOCK_DB("log_commit")
+}
+
+/* nonzero if the newest record of objnum was appended since the last
+   commit mark, so a crash would lose it */
+static Int log_uncommitted(cObjnum objnum) {
+    off_t entry = log_entry(objnum);
+
+    if (entry < 0)
+        entry = -entry;
+    return entry && !(entry & LOG_OLD) && LOG_OFFSET(entry) >= log_committed;
+}
+
+/* fold the record at *rec of the log fd, whose entries carry tag */
+static void log_fold(int fd, off_t * rec, off_t tag) {
+    log_header hdr;
+    cBuf     * buf;
+    off_t      next;
+    off_t      entry = tag | (*rec + 1);
+    Int        newest;
+
+    buf = log_read(fd, *rec, &hdr, &next);
+    if (next == -1) {
+        UNLOCK_DB("simble_checkpoint")
+        panic("simble_checkpoint: bad object log record at %ld.", (long) *rec);
+    }
+
+    /* records which have been superseded since are skipped, unless by a
+       record which is not committed yet: after a crash this one is the
+       latest, and it must not go with log.old */
+    if (hdr.objnum != INV_OBJNUM) {
+        newest = log_entry(hdr.objnum) == (buf ? entry : -entry);
+        if (newest || log_uncommitted(hdr.objnum)) {
+            UNLOCK_DB("simble_checkpoint")
+            if (!buf) {
+                simble_erase(hdr.objnum);
+            } else if (!simble_write(pad_object(buf), hdr.objnum, NULL)) {
+                panic("simble_checkpoint: could not store an object.");
+            }
+            LOCK_DB("simble_checkpoint")
+            buf = NULL;
+            if (newest)
+                log_index[hdr.objnum] = 0;
+        }
+    }
+    if (buf)
+        buffer_discard(buf);
+    *rec = next;
+}
+
+/* the objects folded so far and the index go to disk */
+static void log_sync_folded(void) {
+    if (fsync(database_fd) == F_FAILURE)
+        write_err("ERROR: Unable to sync object database: %s", strerror(errno));
+    lookup_sync();
+}
+
+/* Fold up to maxrecords committed log records into the objects file,
+   those in log.old first.  Returns nonzero while there are more to fold. */
+Int simble_checkpoint(Int maxrecords)
+{
+    LOCK_DB("simble_checkpoint")
+    while (maxrecords-- > 0) {
+        if (old_fd != -1 && old_folded < old_end)
+            log_fold(old_fd, &old_folded, LOG_OLD);
+        else if (old_fd == -1 && log_folded < log_committed)
+            log_fold(log_fd, &log_folded, 0);
+        else
+            break;
+    }
+
+    /* all of log.old is in the objects file now; once that and the index
+       are on disk it can go */
+    if (old_fd != -1 && old_folded == old_end) {
+        log_sync_folded();
+        close(old_fd);
+        if (unlink(old_name) == F_FAILURE)
+            write_err("ERROR: Unable to remove object log: %s", strerror(errno));
+        old_fd = -1;
+        old_end = old_folded = 0;
+    }
+
+    /* likewise the log itself, when nothing uncommitted follows */
+    if (old_fd == -1 && log_end && log_folded == log_end) {
+        log_sync_folded();
+        if (ftruncate(log_fd, 0) == F_FAILURE)
+            write_err("ERROR: Unable to truncate object log: %s", strerror(errno));
+        log_end = log_committed = log_folded = 0;
+    }
+    UNLOCK_DB("simble_checkpoint")
+
+    return old_fd != -1 || log_folded < log_committed;
+}
+#endif
+
 void simble_close(void)
 {
+#ifdef USE_WRITEBACK_THREAD
+    writeback_stop();
+#endif
+#ifdef USE_OBJECT_LOG
+    /* leave nothing for recovery to do */
+    log_commit();
+    while (simble_checkpoint(CHECKPOINT_RECORDS));
+#endif
     LOCK_DB("simble_close")
+#ifdef USE_OBJECT_LOG
+    close(log_fd);
+    log_fd = -1;
+    if (old_fd != -1)
+        close(old_fd);
+    old_fd = -1;
+    efree(log_index);
+    log_index = NULL;
+    log_index_size = 0;
+#endif
     lookup_close();
-    fclose(database_file);
+#ifdef USE_MMAP_OBJECTS
+    db_unmap();
+#endif
+    close(database_fd);
+    database_fd = -1;
+    simble_free_extents();
+#ifdef USE_OBJECT_LOG
+    if (compact_freed)
+        efree(compact_freed);
+    compact_freed = NULL;
+    compact_freed_size = 0;
+#endif
     efree(bitmap);
     simble_flag_as_clean();
     string_discard(pad_string);
@@ -783,20 +2423,27 @@ void simble_close(void)
 
 void simble_flush(void)
 {
+#ifdef USE_OBJECT_LOG
+    /* everything since the last sync is in the log; one fsync of it is
+       all it takes.  The objects file catches up in simble_checkpoint(). */
+    log_commit();
+    lookup_sync();
+#else
+    writeback_drain();
     lookup_sync();
 
     LOCK_DB("simble_flush")
 
+    /* object writes go straight to the kernel; this is where they become
+       durable, before the clean flag claims they are */
+    if (fsync(database_fd) == F_FAILURE)
+        write_err("ERROR: Unable to sync object database: %s", strerror(errno));
     simble_flag_as_clean();
 
     UNLOCK_DB("simble_flush")
+#endif
 }
 
-#define write_clean_file(_fp_) \
-    fprintf(_fp_, "%s\n%d\n%d\n%d\n%li\n", SYSTEM_TYPE, \
-                VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH,\
-                (long) MAGIC_MODNUMBER)\
-
 void simble_dump_finish(void) {
     FILE * fp;
     char buf[BUF];
@@ -828,6 +2475,11 @@ static void simble_flag_as_clean(void) {
 }
 
 static void simble_flag_as_dirty(void) {
+#ifdef USE_OBJECT_LOG
+    /* the log makes the database recoverable at any point; 'clean' only
+       records which system and version it belongs to */
+    return;
+#endif
     if (db_clean) {
         /* Remove 'clean' file. */
         if (unlink(c_clean_file) == -1) {
@@ -15,6 +15,8 @@
 #include "cdc_db.h"
 #include "util.h"
 #include "execute.h"
+#include <string.h>
+#include <stdint.h>
 #include <time.h>
 #include <sys/time.h>
 #include <unistd.h>
@@ -26,40 +28,131 @@ pthread_t cleaner;
 void *cache_cleaner_worker(void *dummy);
 
 #ifdef DEBUG_BUCKET_LOCK
-#define LOCK_BUCKET(func, bucket) \
-    write_err("%s: locking %d", func, &dirty[bucket].lock); \
-    pthread_mutex_lock(&dirty[bucket].lock); \
-    write_err("%s: locked %d", func, &dirty[bucket].lock);
-#define UNLOCK_BUCKET(func, bucket) \
-    pthread_mutex_unlock(&dirty[bucket].lock); \
-    write_err("%s: unlocked %d", func, &dirty[bucket].lock);
+#define LOCK_DIRTY(func) \
+    write_err("%s: locking %d", func, &dirty.lock); \
+    pthread_mutex_lock(&dirty.lock); \
+    write_err("%s: locked %d", func, &dirty.lock);
+#define UNLOCK_DIRTY(func) \
+    pthread_mutex_unlock(&dirty.lock); \
+    write_err("%s: unlocked %d", func, &dirty.lock);
 #else
-#define LOCK_BUCKET(func, bucket) \
-    pthread_mutex_lock(&dirty[bucket].lock);
-#define UNLOCK_BUCKET(func, bucket) \
-    pthread_mutex_unlock(&dirty[bucket].lock);
+#define LOCK_DIRTY(func) \
+    pthread_mutex_lock(&dirty.lock);
+#define UNLOCK_DIRTY(func) \
+    pthread_mutex_unlock(&dirty.lock);
 #endif
 #else
-#define LOCK_BUCKET(func, bucket)
-#define UNLOCK_BUCKET(func, bucket)
+#define LOCK_DIRTY(func)
+#define UNLOCK_DIRTY(func)
 #endif
 
 
 /*
-// Store dummy objects for chain heads and tails.  This is a little storage-
-// intensive, but it simplifies and speeds up the list operations.
+// Every holder with an object is either on the active list (refs > 0) or
+// on one of the two inactive queues, probation and protected, each kept
+// with the most recently discarded object at its head.  obj->queue says
+// which queue an object goes back to.  Holders without an object wait on
+// the blank list and are used before anything is evicted.
 */
 
-struct cache_buckets {
+struct cache_list {
    Obj *first;
    Obj *last;
+   Int  count;
 };
 
-typedef struct cache_buckets CacheBuckets;
-CacheBuckets *active, *inactive;
+typedef struct cache_list CacheList;
+static CacheList active, blank, inactive[2];
+
+#define CACHE_PROBATION 0
+#define CACHE_PROTECTED 1
+
+/*
+// Objects are found through an open addressed table of objnums, linearly
+// probed and never more than half full.  Removal shifts the entries after
+// a hole back into it, so there are no tombstones to skip.
+*/
+
+struct cache_slot {
+   Long  objnum;
+   Obj  *obj;                          /* NULL for a ghost */
+};
+
+typedef struct cache_slot CacheSlot;
+static CacheSlot *slots;
+static Long       slot_count;          /* always a power of two */
+static Int        slot_shift;          /* 64 - log2(slot_count) */
+static Long       slots_used;
+
+/* holders allocated, whichever list they are on */
+static Int holders;
+
+/*
+// Every object counts its size_object() in cache_resident, measured when
+// it is loaded and again when it goes inactive after being changed.  A
+// big object changed on every call would be walked on every call, so it
+// is only measured again after one change for each MEASURE_BYTES of its
+// size; this is an estimate.  Past cache_bytes, inactive objects are
+// evicted before the next load.
+*/
+static Long cache_resident;
+
+#define MEASURE_BYTES 1024
+
+/* most parents of a new object read ahead, see cache_prefetch_parents() */
+#define PREFETCH_PARENTS 32
+
+#define MIN_SLOTS 16
+
+/*
+// An object evicted from probation by a policy with ghosts leaves its
+// objnum in the index without a holder.  The ring holds the latest
+// cache_size / 2 of them and expires the oldest.  Loading an object which
+// still has a ghost means it was wanted again soon after it was dropped,
+// and it goes straight to the protected queue.  A ghost revived and
+// evicted again is in the ring twice and may expire early, which costs at
+// most a promotion.
+*/
+static Long *ghosts;
+static Int   ghost_max;
+static Int   ghost_head;
+static Int   ghost_count;
+
+/*
+// An eviction policy picks the inactive object to evict.  lru never uses
+// the protected queue, and evicts the least recently used object.  2q
+// (Johnson and Shasha) only promotes an object to protected through a
+// ghost, and evicts from probation while it holds more than a quarter of
+// the cached objects.  A sweep over every object, like a text dump or a grep,
+// then cycles through probation and leaves the protected set alone.
+*/
+struct cache_policy {
+    Ident  *name;
+    Bool    ghosts;
+    Obj  *(*victim)(void);
+};
+
+typedef struct cache_policy CachePolicy;
+
+static Obj *lru_victim(void);
+static Obj *twoq_victim(void);
+
+static CachePolicy policies[] = {
+    { &lru_id,  FALSE, lru_victim },
+    { &twoq_id, TRUE,  twoq_victim },
+    { NULL,     FALSE, NULL }
+};
+
+static CachePolicy *policy;
+
+/* statistics, see object_cache_info() */
+static Long cache_hits;
+static Long cache_misses;
+static Long cache_ghost_hits;
+static Long cache_evictions;
 
 #ifdef USE_DIRTY_LIST
-struct dirty_buckets {
+struct dirty_list {
    Obj *first;
    Obj *last;
 #ifdef USE_CLEANER_THREAD
@@ -67,8 +160,8 @@ struct dirty_buckets {
 #endif
 };
 
-typedef struct dirty_buckets DirtyBuckets;
-DirtyBuckets *dirty;
+typedef struct dirty_list DirtyList;
+static DirtyList dirty;
 #endif
 
 #if DEBUG_CACHE
@@ -78,79 +171,228 @@ Int        _icounter = 0;
 
 /* helper functions */
 
-/* add obj to the head of bucket */
-static inline void cache_add_to_list_head(CacheBuckets *bucket, Obj *obj)
+/* add obj to the head of list */
+static inline void cache_add_to_list_head(CacheList *list, Obj *obj)
 {
     obj->prev_obj = NULL;
-    obj->next_obj = bucket->first;
+    obj->next_obj = list->first;
+
+    if (list->first)
+        list->first->prev_obj = obj;
 
-    /* redundant? */
-    if (bucket->first)
-        bucket->first->prev_obj = obj;
+    list->first = obj;
 
-    bucket->first = obj;
+    if (list->last == NULL)
+        list->last = obj;
 
-    if (bucket->last == NULL)
-        bucket->last = obj;
+    list->count++;
 }
 
-/* add obj to the tail of bucket */
-static inline void cache_add_to_list_tail(CacheBuckets *bucket, Obj *obj)
+/* add obj to the tail of list */
+static inline void cache_add_to_list_tail(CacheList *list, Obj *obj)
 {
     obj->next_obj = NULL;
-    obj->prev_obj = bucket->last;
+    obj->prev_obj = list->last;
 
-    /* redundant? */
-    if (bucket->last)
-        bucket->last->next_obj = obj;
+    if (list->last)
+        list->last->next_obj = obj;
 
-    bucket->last = obj;
+    list->last = obj;
 
-    if (bucket->first == NULL)
-        bucket->first = obj;
+    if (list->first == NULL)
+        list->first = obj;
+
+    list->count++;
 }
 
-static inline void cache_remove_from_list(CacheBuckets *bucket, Obj *obj)
+static inline void cache_remove_from_list(CacheList *list, Obj *obj)
 {
     if (obj->next_obj)
         obj->next_obj->prev_obj = obj->prev_obj;
     if (obj->prev_obj)
         obj->prev_obj->next_obj = obj->next_obj;
-    if (obj == bucket->first)
-        bucket->first = obj->next_obj;
-    if (obj == bucket->last)
-        bucket->last = obj->prev_obj;
+    if (obj == list->first)
+        list->first = obj->next_obj;
+    if (obj == list->last)
+        list->last = obj->prev_obj;
     obj->next_obj = obj->prev_obj = NULL;
+
+    list->count--;
+}
+
+/* Fibonacci hashing, objnums are mostly sequential */
+static inline Long cache_hash(Long objnum)
+{
+    return (Long) (((uint64_t) objnum * 0x9E3779B97F4A7C15ULL) >> slot_shift);
+}
+
+static inline CacheSlot *cache_slot(Long objnum)
+{
+    Long i = cache_hash(objnum);
+
+    while (slots[i].objnum != INV_OBJNUM) {
+        if (slots[i].objnum == objnum)
+            return &slots[i];
+        i = (i + 1) & (slot_count - 1);
+    }
+
+    return NULL;
+}
+
+static inline Obj *cache_find(Long objnum)
+{
+    CacheSlot *slot = cache_slot(objnum);
+
+    return slot ? slot->obj : NULL;
+}
+
+static void cache_index_resize(Long count)
+{
+    CacheSlot *old = slots;
+    Long       old_count = slot_count,
+               i, j;
+
+    slots = EMALLOC(CacheSlot, count);
+    slot_count = count;
+    for (slot_shift = 64; count > 1; count >>= 1)
+        slot_shift--;
+    for (i = 0; i < slot_count; i++) {
+        slots[i].objnum = INV_OBJNUM;
+        slots[i].obj = NULL;
+    }
+
+    for (i = 0; i < old_count; i++) {
+        if (old[i].objnum == INV_OBJNUM)
+            continue;
+        j = cache_hash(old[i].objnum);
+        while (slots[j].objnum != INV_OBJNUM)
+            j = (j + 1) & (slot_count - 1);
+        slots[j] = old[i];
+    }
+
+    if (old)
+        efree(old);
+}
+
+/* the table size for n entries, keeping it at most half full */
+static Long cache_index_size(Long n)
+{
+    Long count = MIN_SLOTS;
+
+    while (count < n * 2)
+        count <<= 1;
+
+    return count;
+}
+
+static void cache_index(Obj *obj)
+{
+    Long i;
+
+    if ((slots_used + 1) * 2 > slot_count)
+        cache_index_resize(slot_count * 2);
+
+    i = cache_hash(obj->objnum);
+    while (slots[i].objnum != INV_OBJNUM)
+        i = (i + 1) & (slot_count - 1);
+    slots[i].objnum = obj->objnum;
+    slots[i].obj = obj;
+    slots_used++;
+}
+
+static void cache_unindex(Long objnum)
+{
+    Long mask = slot_count - 1,
+         i = cache_hash(objnum),
+         j,
+         home;
+
+    while (slots[i].objnum != objnum) {
+        if (slots[i].objnum == INV_OBJNUM)
+            return;
+        i = (i + 1) & mask;
+    }
+
+    /* Shift back every entry after the hole that could not have been
+       placed at its own home slot or anywhere up to the hole. */
+    for (j = (i + 1) & mask; slots[j].objnum != INV_OBJNUM; j = (j + 1) & mask) {
+        home = cache_hash(slots[j].objnum);
+        if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+            continue;
+        slots[i] = slots[j];
+        i = j;
+    }
+
+    slots[i].objnum = INV_OBJNUM;
+    slots[i].obj = NULL;
+    slots_used--;
+}
+
+static void cache_expire_ghost(void)
+{
+    CacheSlot *slot = cache_slot(ghosts[ghost_head]);
+
+    /* it may have been loaded again since */
+    if (slot && !slot->obj)
+        cache_unindex(ghosts[ghost_head]);
+
+    ghost_head = (ghost_head + 1) % ghost_max;
+    ghost_count--;
+}
+
+static void cache_ghost(Long objnum)
+{
+    if (ghost_count == ghost_max)
+        cache_expire_ghost();
+
+    cache_slot(objnum)->obj = NULL;
+    ghosts[(ghost_head + ghost_count) % ghost_max] = objnum;
+    ghost_count++;
+}
+
+static void cache_clear_ghosts(void)
+{
+    while (ghost_count)
+        cache_expire_ghost();
+    ghost_head = 0;
+}
+
+static Obj *lru_victim(void)
+{
+    return inactive[CACHE_PROBATION].last;
+}
+
+static Obj *twoq_victim(void)
+{
+    if (inactive[CACHE_PROBATION].last &&
+        (inactive[CACHE_PROBATION].count > (holders - blank.count) / 4 ||
+         !inactive[CACHE_PROTECTED].last))
+        return inactive[CACHE_PROBATION].last;
+
+    return inactive[CACHE_PROTECTED].last;
 }
 
 #ifdef USE_DIRTY_LIST
 static inline void cache_add_to_dirty_list(Obj *obj)
 {
-    Int ind;
-
-    ind = obj->objnum % cache_width;
     obj->prev_dirty = NULL;
-    obj->next_dirty = dirty[ind].first;
+    obj->next_dirty = dirty.first;
 
-    if (dirty[ind].first)
-        dirty[ind].first->prev_dirty = obj;
+    if (dirty.first)
+        dirty.first->prev_dirty = obj;
 
-    dirty[ind].first = obj;
+    dirty.first = obj;
 
-    if (dirty[ind].last == NULL)
-        dirty[ind].last = obj;
+    if (dirty.last == NULL)
+        dirty.last = obj;
 }
 
 inline void cache_dirty_object(Obj *obj)
 {
-#ifdef USE_CLEANER_THREAD
-    Int ind;
-
-    ind = obj->objnum % cache_width;
-#endif
-    LOCK_BUCKET("cache_dirty_object", ind)
+    LOCK_DIRTY("cache_dirty_object")
 
     obj->dirty++;
+    obj->sized = 0;
 
     if ((cache_watch_object == obj->objnum) &&
         !(obj->dirty % cache_watch_count))
@@ -162,37 +404,178 @@ inline void cache_dirty_object(Obj *obj)
     if (obj->dirty == 1)
         cache_add_to_dirty_list(obj);
 
-    UNLOCK_BUCKET("cache_dirty_object", ind)
+    UNLOCK_DIRTY("cache_dirty_object")
 }
 
-static inline void cache_remove_from_dirty(DirtyBuckets *bucket, Obj *obj)
+static inline void cache_remove_from_dirty(Obj *obj)
 {
     if (obj->next_dirty)
         obj->next_dirty->prev_dirty = obj->prev_dirty;
     if (obj->prev_dirty)
         obj->prev_dirty->next_dirty = obj->next_dirty;
-    if (obj == bucket->first)
-        bucket->first = obj->next_dirty;
-    if (obj == bucket->last)
-        bucket->last = obj->prev_dirty;
+    if (obj == dirty.first)
+        dirty.first = obj->next_dirty;
+    if (obj == dirty.last)
+        dirty.last = obj->prev_dirty;
     obj->next_dirty = obj->prev_dirty = NULL;
 }
 #endif
 
+static Obj *cache_new_holder(void)
+{
+    Obj *obj = EMALLOC(Obj, 1);
+
+    obj->objnum = INV_OBJNUM;
+#ifdef CLEAN_CACHE
+    obj->ucounter = 0;
+#endif
+    obj->dead = 0;
+    obj->queue = CACHE_PROBATION;
+    obj->refs = 0;
+    obj->dirty = 0;
+    obj->resident = 0;
+    obj->sized = 0;
+    obj->measure_wait = 0;
+#ifdef USE_DIRTY_LIST
+    obj->next_dirty = obj->prev_dirty = NULL;
+#endif
+    holders++;
+
+    return obj;
+}
+
+/* count obj in cache_resident at its current size */
+static void cache_measure(Obj *obj)
+{
+    Long size = size_object(obj, 1);
+
+    cache_resident += size - obj->resident;
+    obj->resident = size;
+    obj->sized = 1;
+    obj->measure_wait = size / MEASURE_BYTES;
+}
+
+/*
+// Start the reads for the parents of a newly loaded object which are not
+// cached, since a method search is about to want them.  A lone parent is
+// read right away anyway, so it is left alone.
+*/
+static void cache_prefetch_parents(Obj *obj)
+{
+    cObjnum  want[PREFETCH_PARENTS];
+    cData   *d;
+    Int      n = 0;
+
+    for (d = list_first(obj->parents); d && n < PREFETCH_PARENTS;
+         d = list_next(obj->parents, d)) {
+        if (!cache_find(d->u.objnum))
+            want[n++] = d->u.objnum;
+    }
+
+    if (n > 1)
+        simble_prefetch(want, n);
+}
+
+/*
+// Write out an inactive object if it is dirty, free it and blank the
+// holder, leaving a ghost if asked.  The holder stays where it is.
+*/
+static void cache_evict(Obj *obj, Bool ghost, Int log_flag, char *func)
+{
+    Long obj_size;
+
+    if (obj->objnum == INV_OBJNUM)
+        return;
+
+    LOCK_DIRTY(func)
+    if (obj->dirty) {
+        if (!simble_put(obj, obj->objnum, &obj_size)) {
+            UNLOCK_DIRTY(func)
+            panic("Could not store an object.");
+        }
+        if (cache_log_flag & log_flag)
+            write_err("%s: wrote object %s (size: %d bytes) (dirty: %d)",
+                      func, obj->objname != -1 ? ident_name(obj->objname) : "not named",
+                      obj_size, obj->dirty);
+
+        obj->dirty = 0;
+#ifdef USE_DIRTY_LIST
+        cache_remove_from_dirty(obj);
+#endif
+    }
+    UNLOCK_DIRTY(func)
+
+#if DEBUG_CACHE
+    _icounter--;
+#endif
+    if (ghost)
+        cache_ghost(obj->objnum);
+    else
+        cache_unindex(obj->objnum);
+    object_free(obj);
+    obj->objnum = INV_OBJNUM;
+    cache_resident -= obj->resident;
+    obj->resident = 0;
+    cache_evictions++;
+}
+
+/*
+// Evict the object the policy picks and unlink its holder.  Returns NULL
+// if nothing is inactive.
+*/
+static Obj *cache_evict_victim(char *func)
+{
+    Obj *obj;
+
+    if (!(obj = policy->victim()))
+        return NULL;
+
+    cache_evict(obj, policy->ghosts && obj->queue == CACHE_PROBATION,
+                CACHE_LOG_OVERFLOW, func);
+    cache_remove_from_list(&inactive[obj->queue], obj);
+
+    return obj;
+}
+
+/*
+// Take a holder off the blank list, or else evict the policy's victim
+// for it.  Returns NULL if every holder is active.
+*/
+static Obj *cache_reclaim(char *func)
+{
+    Obj *obj;
+
+    if ((obj = blank.last)) {
+        cache_remove_from_list(&blank, obj);
+        return obj;
+    }
+
+    return cache_evict_victim(func);
+}
+
+/* evict inactive objects until the cache is back within cache_bytes */
+static void cache_trim_bytes(char *func)
+{
+    Obj *obj;
+
+    while (cache_bytes && cache_resident > cache_bytes &&
+           (obj = cache_evict_victim(func)))
+        cache_add_to_list_tail(&blank, obj);
+}
+
 /*
 // ----------------------------------------------------------------------
 //
 // Requires: Shouldn't be called twice.
-// Modifies: active, inactive, dirty.
-// Effects: Builds an array of object chains in inactive, and an array of
-//            empty object chains in active.
+// Modifies: active, blank, inactive, dirty, slots, ghosts.
+// Effects: Builds a blank list of cache_size empty holders, empty active
+//            and inactive lists, and an index sized for them.
 //
 */
 
 void init_cache(Bool spawn_cleaner)
 {
-    Obj *obj;
-    Int        i, j;
+    Int        i;
 
     cache_log_flag      = 0;
     cache_watch_object  = INV_OBJNUM;
@@ -201,13 +584,35 @@ void init_cache(Bool spawn_cleaner)
     cleaner_wait          = 10;
     cleaner_ignore_dict = dict_new_empty();
 #endif
-    active              = EMALLOC(CacheBuckets, cache_width);
-    inactive            = EMALLOC(CacheBuckets, cache_width);
+
+    if (cache_size < 1)
+        cache_size = 1;
+
+    for (policy = policies; policy->name; policy++) {
+        if (!strcmp(ident_name(*policy->name), CACHE_POLICY))
+            break;
+    }
+    if (!policy->name)
+        policy = policies;
+
+    memset(&active, 0, sizeof(CacheList));
+    memset(&blank, 0, sizeof(CacheList));
+    memset(inactive, 0, sizeof(inactive));
+    slots = NULL;
+    slot_count = slots_used = 0;
+    holders = 0;
+    cache_resident = 0;
+    ghost_max = cache_size / 2 ? cache_size / 2 : 1;
+    ghosts = EMALLOC(Long, ghost_max);
+    ghost_head = ghost_count = 0;
+    cache_index_resize(cache_index_size(cache_size + ghost_max));
+
 #ifdef USE_DIRTY_LIST
-    dirty               = EMALLOC(DirtyBuckets, cache_width);
+    dirty.first = dirty.last = NULL;
 #endif
 
 #ifdef USE_CLEANER_THREAD
+    pthread_mutex_init(&dirty.lock, NULL);
     pthread_mutex_init(&cleaner_lock, NULL);
     pthread_cond_init(&cleaner_condition, NULL);
     if (spawn_cleaner) {
@@ -220,124 +625,196 @@ void init_cache(Bool spawn_cleaner)
     }
 #endif
 
-    memset(active, 0, sizeof(CacheBuckets)*cache_width);
-#ifdef USE_DIRTY_LIST
-    memset(dirty, 0, sizeof(DirtyBuckets)*cache_width);
-#endif
-
-    for (i = 0; i < cache_width; i++) {
-#ifdef USE_CLEANER_THREAD
-        pthread_mutex_init(&dirty[i].lock, NULL);
-#endif
+    for (i = 0; i < cache_size; i++)
+        cache_add_to_list_head(&blank, cache_new_holder());
+}
 
-        /* Inactive list begins as a chain of empty objects. */
-        inactive[i].first = inactive[i].last = NULL;
-        for (j = 0; j < cache_depth; j++) {
-            obj = EMALLOC(Obj, 1);
-            obj->objnum = INV_OBJNUM;
-#ifdef CLEAN_CACHE
-            obj->ucounter=0;
-#endif
-            obj->dead=0;
+static void uninit_list(CacheList *list, Bool is_active)
+{
+    Obj *tmp;
 
-            cache_add_to_list_head(&inactive[i], obj);
+    while (list->first) {
+        tmp = list->first;
+        list->first = list->first->next_obj;
+        if (tmp->objnum != INV_OBJNUM) {
+            if (is_active) {
+                fprintf(stderr, "object %s($%d) still active!\n",
+                        tmp->objname != -1 ? ident_name(tmp->objname) : "not named", tmp->objnum);
+                if (tmp->dirty)
+                    fprintf(stderr, "and its dirty still!!\n");
+            } else if (tmp->dirty) {
+                fprintf(stderr, "object %s($%d) is still dirty!\n",
+                        tmp->objname != -1 ? ident_name(tmp->objname) : "not named", tmp->objnum);
+            }
+            object_free(tmp);
         }
+        efree(tmp);
     }
+    memset(list, 0, sizeof(CacheList));
 }
 
 void uninit_cache()
 {
-    Int i;
-
 #ifdef USE_CLEANER_THREAD
     dict_discard(cleaner_ignore_dict);
 #endif
-#ifdef USE_DIRTY_LIST
-    efree(dirty);
-#endif
-    for (i = 0; i < cache_width; i++) {
-        while (active[i].first) {
-            Obj *tmp = active[i].first;
-            active[i].first = active[i].first->next_obj;
-            if (tmp->objnum != INV_OBJNUM) {
-                fprintf(stderr, "object %s($%d) still active!\n",
-                        tmp->objname != -1 ? ident_name(tmp->objname) : "not named", tmp->objnum);
-                if (tmp->dirty)
-                    fprintf(stderr, "and its dirty still!!\n");
-                object_free(tmp);
-            }
-            efree(tmp);
-        }
+    uninit_list(&active, TRUE);
+    uninit_list(&inactive[CACHE_PROBATION], FALSE);
+    uninit_list(&inactive[CACHE_PROTECTED], FALSE);
+    uninit_list(&blank, FALSE);
+    holders = 0;
+    cache_resident = 0;
+
+    efree(ghosts);
+    ghosts = NULL;
+    ghost_count = 0;
+    efree(slots);
+    slots = NULL;
+    slot_count = slots_used = 0;
+}
 
-        while (inactive[i].first) {
-            Obj *tmp = inactive[i].first;
-            inactive[i].first = inactive[i].first->next_obj;
-            if (tmp->objnum != INV_OBJNUM) {
-                if (tmp->dirty)
-                    fprintf(stderr, "object %s($%d) is still dirty!\n",
-                            tmp->objname != -1 ? ident_name(tmp->objname) : "not named", tmp->objnum);
-                object_free(tmp);
-            }
-            efree(tmp);
-        }
+/*
+// ----------------------------------------------------------------------
+//
+// Requires: Initialized cache.
+// Modifies: cache_size, contents of blank and inactive, slots, ghosts,
+//            database files.
+// Effects: Sets the number of objects the cache holds.  Growing adds
+//            blank holders; shrinking writes out and frees inactive
+//            objects in the order the policy would evict them.  Active
+//            objects are never dropped, so the cache may stay over size
+//            until they are discarded; cache_get_holder() trims it from
+//            then on.  Ghosts are forgotten.
+//
+*/
+
+void cache_resize(Int size)
+{
+    Obj *obj;
+
+    if (size < 1)
+        size = 1;
+    cache_size = size;
+
+    while (holders < cache_size)
+        cache_add_to_list_tail(&blank, cache_new_holder());
+
+    while (holders > cache_size && (obj = cache_reclaim("cache_resize"))) {
+        efree(obj);
+        holders--;
     }
-    efree(active);
-    efree(inactive);
+
+    cache_clear_ghosts();
+    ghost_max = cache_size / 2 ? cache_size / 2 : 1;
+    ghosts = EREALLOC(ghosts, Long, ghost_max);
+
+    if (cache_index_size(holders + ghost_max) != slot_count)
+        cache_index_resize(cache_index_size(holders + ghost_max));
 }
 
 /*
 // ----------------------------------------------------------------------
 //
 // Requires: Initialized cache.
-// Modifies: Contents of active, inactive, database files
-// Effects: Returns an object holder linked to the head of the appropriate
-//            active chain.  Gets the object holder from the tail of the inactive
-//            chain, swapping out the object there if necessary.  If the inactive
-//            inactive chain is empty, then we create a new holder.
+// Modifies: cache_bytes, contents of blank and inactive, slots, ghosts,
+//            database files.
+// Effects: Sets the most bytes the cached objects may take up, zero for
+//            no limit, and evicts inactive objects until they fit.
 //
 */
 
-Obj * cache_get_holder(Long objnum) {
-    Int ind = objnum % cache_width;
-    Obj *obj;
-    Long obj_size;
+void cache_set_bytes(Long bytes)
+{
+    cache_bytes = bytes;
+    cache_trim_bytes("cache_set_bytes");
+}
 
-    if (inactive[ind].last) {
-        /* Use the object at the tail of the inactive list. */
-        obj = inactive[ind].last;
+/*
+// ----------------------------------------------------------------------
+//
+// Requires: Initialized cache.
+// Modifies: policy, contents of inactive, ghosts.
+// Effects: Switches to the eviction policy called name, returning FALSE
+//            if there is none.  Moving to a policy without ghosts folds
+//            the protected queue into the head of probation.
+//
+*/
 
-        /* Check if we need to swap anything out. */
-        if (obj->objnum != INV_OBJNUM) {
-            LOCK_BUCKET("cache_get_holder", ind)
-            if (obj->dirty) {
-                if (!simble_put(obj, obj->objnum, &obj_size)) {
-                    UNLOCK_BUCKET("cache_get_holder", ind)
-                    panic("Could not store an object.");
-                }
-                if (cache_log_flag & CACHE_LOG_OVERFLOW)
-                    write_err("cache_get_holder: wrote object %s (size: %d bytes) (dirty: %d)",
-                              obj->objname != -1 ? ident_name(obj->objname) : "not named", obj_size, obj->dirty);
+Bool cache_set_policy(Ident name)
+{
+    CachePolicy *p;
+    Obj         *obj;
 
-                obj->dirty = 0;
-#ifdef USE_DIRTY_LIST
-                cache_remove_from_dirty(&dirty[ind], obj);
-#endif
-            }
-            UNLOCK_BUCKET("cache_get_holder", ind)
-            object_free(obj);
-        }
+    for (p = policies; p->name; p++) {
+        if (*p->name == name)
+            break;
+    }
+    if (!p->name)
+        return FALSE;
+
+    policy = p;
+    if (policy->ghosts)
+        return TRUE;
+
+    cache_clear_ghosts();
+    while ((obj = inactive[CACHE_PROTECTED].last)) {
+        cache_remove_from_list(&inactive[CACHE_PROTECTED], obj);
+        obj->queue = CACHE_PROBATION;
+        cache_add_to_list_head(&inactive[CACHE_PROBATION], obj);
+    }
+    for (obj = active.first; obj; obj = obj->next_obj)
+        obj->queue = CACHE_PROBATION;
 
-        /* Unlink it from the inactive list, tail still. */
-        cache_remove_from_list(&inactive[ind], obj);
-    } else {
+    return TRUE;
+}
+
+Ident cache_policy(void)
+{
+    return *policy->name;
+}
+
+/*
+// ----------------------------------------------------------------------
+//
+// Requires: Initialized cache.
+// Modifies: Contents of active, blank, inactive, slots, database files
+// Effects: Returns an object holder linked to the head of the active list.
+//            First evicts inactive objects while the cache is over
+//            cache_bytes.  Takes a blank holder if there is one, or else
+//            the one holding the inactive object the policy evicts,
+//            swapping it out.  If every holder is active, then we create
+//            a new holder.
+//
+*/
+
+Obj * cache_get_holder(Long objnum) {
+    CacheSlot *slot;
+    Obj       *obj;
+
+    cache_trim_bytes("cache_get_holder");
+
+    /* Drop holders left over from a shrink, or from more objects being
+       active at once than the cache holds, keeping one to reuse. */
+    while (holders > cache_size &&
+           blank.count + inactive[CACHE_PROBATION].count +
+           inactive[CACHE_PROTECTED].count > 1) {
+        efree(cache_reclaim("cache_get_holder"));
+        holders--;
+    }
+
+    if (!(obj = cache_reclaim("cache_get_holder"))) {
         /* Allocate a new object. */
-        obj = EMALLOC(Obj, 1);
-        write_err("cache_get_holder: no holders left, allocating a blank object");
+        obj = cache_new_holder();
+        if (cache_log_flag & CACHE_LOG_OVERFLOW)
+            write_err("cache_get_holder: no holders left, allocating a blank object");
     }
 
     obj->objnum = objnum;
+    OBJECT_NEW_METHOD_SERIAL(obj);
     obj->search = START_SEARCH_AT;
     obj->dirty = 0;
+    obj->sized = 0;
+    obj->measure_wait = 0;
     obj->dead = 0;
     obj->refs = 1;
 #ifdef CLEAN_CACHE
@@ -352,8 +829,19 @@ Obj * cache_get_holder(Long objnum) {
     _acounter++;
 #endif
 
-    /* Link the object at the head of the active chain. */
-    cache_add_to_list_head(&active[ind], obj);
+    /* Link the object at the head of the active list. */
+    cache_add_to_list_head(&active, obj);
+
+    slot = cache_slot(objnum);
+    if (slot) {
+        /* a ghost, dropped from probation not long ago */
+        slot->obj = obj;
+        obj->queue = CACHE_PROTECTED;
+        cache_ghost_hits++;
+    } else {
+        cache_index(obj);
+        obj->queue = CACHE_PROBATION;
+    }
 
     return obj;
 }
@@ -362,67 +850,61 @@ Obj * cache_get_holder(Long objnum) {
 // ----------------------------------------------------------------------
 //
 // Requires: Initialized cache.
-// Modifies: Contents of active, inactive, database files
+// Modifies: Contents of active, blank, inactive, slots, database files
 // Effects: Returns the object associated with objnum, getting it from the cache
-//            or from disk.  If the object is in the inactive chain or is on
-//            disk, it will be linked into the active chain.  Returns NULL if no
-//            object exists with the given objnum.
+//            or from disk.  If the object is inactive or is on disk, it will
+//            be linked into the active list.  Returns NULL if no object
+//            exists with the given objnum.
 //
 */
 Obj *cache_retrieve(Long objnum) {
-    Int ind = objnum % cache_width;
     Obj *obj;
     Long obj_size;
 
     if (objnum < 0)
         return NULL;
 
-    /* Search active chain for object. */
-    for (obj = active[ind].first; obj; obj = obj->next_obj) {
-        if (obj->objnum == objnum) {
-            obj->refs++;
-#ifdef CLEAN_CACHE
-            obj->ucounter += OBJECT_PERSISTENCE;
-#endif
-            return obj;
-        }
-    }
-
-    /* Search inactive chain for object. */
-    for (obj = inactive[ind].first; obj; obj = obj->next_obj) {
-        if (obj->objnum == objnum) {
-            cache_remove_from_list(&inactive[ind], obj);
+    obj = cache_find(objnum);
+    if (obj) {
+        if (!obj->refs) {
+            cache_remove_from_list(&inactive[obj->queue], obj);
 
 #if DEBUG_CACHE
             _icounter--;
+            _acounter++;
 #endif
-            /* Install object at head of active chain. */
-            cache_add_to_list_head(&active[ind], obj);
+            /* Install object at head of active list. */
+            cache_add_to_list_head(&active, obj);
+        }
 
-            obj->refs = 1;
+        obj->refs++;
 #ifdef CLEAN_CACHE
-            obj->ucounter += OBJECT_PERSISTENCE;
-#endif
-#if DEBUG_CACHE
-            _acounter++;
+        obj->ucounter += OBJECT_PERSISTENCE;
 #endif
-            return obj;
-        }
+        cache_hits++;
+        return obj;
     }
 
     /* Cache miss.  Find an object to load in from disk. */
+    cache_misses++;
     obj = cache_get_holder(objnum);
 
     /* Read the object into the place-holder, if it's on disk. */
-    LOCK_BUCKET("cache_retrieve", ind)
+    LOCK_DIRTY("cache_retrieve")
     if (!simble_get(obj, objnum, &obj_size)) {
-        /* Oops.  add back to inactive list tail*/
+        /* Oops.  back to the blank list */
+        cache_unindex(objnum);
         obj->objnum = INV_OBJNUM;
-        cache_remove_from_list(&active[ind], obj);
-        cache_add_to_list_tail(&inactive[ind], obj);
+        obj->refs = 0;
+        cache_remove_from_list(&active, obj);
+        cache_add_to_list_tail(&blank, obj);
         obj = NULL;
     }
-    UNLOCK_BUCKET("cache_retrieve", ind)
+    UNLOCK_DIRTY("cache_retrieve")
+    if (obj) {
+        cache_measure(obj);
+        cache_prefetch_parents(obj);
+    }
     if (obj && cache_log_flag & CACHE_LOG_READ)
         write_err("cache_retrieve: read object %s (size: %d bytes)",
                   obj->objname != -1 ? ident_name(obj->objname) : "not named", obj_size);
@@ -449,16 +931,16 @@ Obj *cache_grab(Obj *obj) {
 // ----------------------------------------------------------------------
 //
 // Requires: Initialized cache.  obj should point to an active object.
-// Modifies: obj, contents of active and inactive, database files.
-// Effects: Decreases the refcount on obj, unlinking it from the active chain
-//            if the refcount hits zero.  If the object is marked dead, then it
-//            is destroyed when it is unlinked from the active chain.
+// Modifies: obj, contents of active, blank, inactive and slots, database
+//            files.
+// Effects: Decreases the refcount on obj, moving it from the active list
+//            to the head of its inactive queue if the refcount hits zero.
+//            If the object is marked dead, then it is destroyed instead and
+//            its holder goes to the blank list.
 //
 */
 
 void cache_discard(Obj *obj) {
-    Int ind;
-
     if (!obj)
       return;
 
@@ -470,33 +952,39 @@ void cache_discard(Obj *obj) {
 #if DEBUG_CACHE
     _acounter--;
 #endif
-    ind = obj->objnum % cache_width;
 
-    /* Reference count hit 0; remove from active chain. */
-    cache_remove_from_list(&active[ind], obj);
+    /* Reference count hit 0; remove from active list. */
+    cache_remove_from_list(&active, obj);
 
     if (obj->dead) {
-        /* The object is dead; remove it from the database, and install the
-           holder at the tail of the inactive chain.  Be careful about this,
+        /* The object is dead; remove it from the database, and put the
+           holder on the blank list.  Be careful about this,
            since object_destroy() can fiddle with the cache.  We're safe as
-           long as obj isn't in any chains at the time of simble_del(). */
+           long as obj isn't in any lists at the time of simble_del(). */
         object_destroy(obj);
         simble_del(obj->objnum);
 
-        LOCK_BUCKET("cache_discard", ind)
+        LOCK_DIRTY("cache_discard")
 
         obj->dirty = 0;
 #ifdef USE_DIRTY_LIST
-        cache_remove_from_dirty(&dirty[ind], obj);
+        cache_remove_from_dirty(obj);
 #endif
 
-        UNLOCK_BUCKET("cache_discard", ind)
+        UNLOCK_DIRTY("cache_discard")
 
+        cache_unindex(obj->objnum);
         obj->objnum = INV_OBJNUM;
-        cache_add_to_list_tail(&inactive[ind], obj);
+        cache_resident -= obj->resident;
+        obj->resident = 0;
+        cache_add_to_list_tail(&blank, obj);
     } else {
-        /* Install at head of inactive chain. */
-        cache_add_to_list_head(&inactive[ind], obj);
+        /* It may have changed size while active. */
+        if (!obj->sized && --obj->measure_wait <= 0)
+            cache_measure(obj);
+
+        /* Install at head of its inactive queue. */
+        cache_add_to_list_head(&inactive[obj->queue], obj);
 #if DEBUG_CACHE
         _icounter++;
 #endif
@@ -512,23 +1000,11 @@ void cache_discard(Obj *obj) {
 */
 
 Int cache_check(Long objnum) {
-    Int ind = objnum % cache_width;
-    Obj *obj;
-
     if (objnum < 0)
         return 0;
 
-    /* Search active chain. */
-    for (obj = active[ind].first; obj; obj = obj->next_obj) {
-        if (obj->objnum == objnum)
-            return 1;
-    }
-
-    /* Search inactive chain. */
-    for (obj = inactive[ind].first; obj; obj = obj->next_obj) {
-        if (obj->objnum == objnum)
-            return 1;
-    }
+    if (cache_find(objnum))
+        return 1;
 
     /* Check database on disk. */
     return simble_check(objnum);
@@ -544,7 +1020,6 @@ Int cache_check(Long objnum) {
 */
 
 void cache_sync(void) {
-    Int i;
 #ifndef USE_DIRTY_LIST
     Int j;
 #else
@@ -562,58 +1037,56 @@ void cache_sync(void) {
     write_err("cache_sync: locked cleaner");
 #endif
 #endif
-    /* Traverse all the active and inactive chains. */
     if (cache_log_flag & CACHE_LOG_SYNC)
         write_err("cache_sync: start of sync");
-    for (i = 0; i < cache_width; i++) {
-        /* Check active chain. */
-        LOCK_BUCKET("cache_sync", i)
+
+    LOCK_DIRTY("cache_sync")
 
 #ifndef USE_DIRTY_LIST
-        for (j=0; j<2; j++)
-        {
-            if (j == 0)
-                obj = active[i].first;
-            else
-                obj = inactive[i].first;
+    /* Traverse the active and inactive lists. */
+    for (j=0; j<3; j++)
+    {
+        if (j == 0)
+            obj = active.first;
+        else
+            obj = inactive[j - 1].first;
 #else
-            obj = dirty[i].first;
+        obj = dirty.first;
 #endif
-            while (obj) {
+        while (obj) {
 #ifndef USE_DIRTY_LIST
-                if (obj->objnum != INV_OBJNUM && obj->dirty) {
-#endif
-                    if (obj->dead) {
-                        if (cache_log_flag & CACHE_LOG_DEAD_WRITE)
-                            write_err("cache_sync: skipping dead object");
-                    } else {
-                        if (!simble_put(obj, obj->objnum, &obj_size)) {
-                            UNLOCK_BUCKET("cache_sync", i)
-                            panic("Could not store an object.");
-                        }
-                        if (cache_log_flag & CACHE_LOG_SYNC)
-                            write_err("cache_sync: wrote object %s (size: %d bytes) (dirty: %d)",
-                                      obj->objname != -1 ? ident_name(obj->objname) : "not named", obj_size, obj->dirty);
-                        obj->dirty = 0;
+            if (obj->objnum != INV_OBJNUM && obj->dirty) {
+#endif
+                if (obj->dead) {
+                    if (cache_log_flag & CACHE_LOG_DEAD_WRITE)
+                        write_err("cache_sync: skipping dead object");
+                } else {
+                    if (!simble_put(obj, obj->objnum, &obj_size)) {
+                        UNLOCK_DIRTY("cache_sync")
+                        panic("Could not store an object.");
                     }
-#ifndef USE_DIRTY_LIST
+                    if (cache_log_flag & CACHE_LOG_SYNC)
+                        write_err("cache_sync: wrote object %s (size: %d bytes) (dirty: %d)",
+                                  obj->objname != -1 ? ident_name(obj->objname) : "not named", obj_size, obj->dirty);
+                    obj->dirty = 0;
                 }
+#ifndef USE_DIRTY_LIST
+            }
 #endif
 #ifdef USE_DIRTY_LIST
-                tobj = obj->next_dirty;
-                obj->next_dirty = obj->prev_dirty = NULL;
-                obj = tobj;
+            tobj = obj->next_dirty;
+            obj->next_dirty = obj->prev_dirty = NULL;
+            obj = tobj;
 #else
-                obj = obj->next_obj;
+            obj = obj->next_obj;
 #endif
-            }
-#ifndef USE_DIRTY_LIST
         }
+#ifndef USE_DIRTY_LIST
+    }
 #else
-        dirty[i].first = dirty[i].last = NULL;
+    dirty.first = dirty.last = NULL;
 #endif
-        UNLOCK_BUCKET("cache_sync", i)
-    }
+    UNLOCK_DIRTY("cache_sync")
 
     simble_flush();
 #ifdef USE_CLEANER_THREAD
@@ -627,9 +1100,6 @@ void cache_sync(void) {
 #ifdef USE_CLEANER_THREAD
 void *cache_cleaner_worker(void *dummy)
 {
-    Int     cache_bucket = 0,
-            start_bucket,
-            wrote_something;
     Obj   * tobj,
           * tobj2;
     Long    obj_size;
@@ -659,44 +1129,35 @@ void *cache_cleaner_worker(void *dummy)
         write_err("cache_cleaner_worker: end cond_timedwait");
 #endif
 
-        start_bucket = cache_bucket;
-        wrote_something = 0;
         cthis.type = OBJNUM;
-        do {
-            LOCK_BUCKET("cache_cleaner_worker", cache_bucket)
-            tobj = dirty[cache_bucket].first;
-            while (tobj) {
-                cthis.u.objnum = tobj->objnum;
-                if (tobj->refs == 0 &&
-                    !dict_contains(cleaner_ignore_dict, &cthis)) {
-                    if (tobj->dead) {
-                        if (cache_log_flag & CACHE_LOG_DEAD_WRITE)
-                            write_err("cache_cleaner_worker: skipping dead object");
-                    } else {
-                        wrote_something = 1;
-                        if (!simble_put(tobj, tobj->objnum, &obj_size)) {
-                            UNLOCK_BUCKET("cache_cleaner_worker", cache_bucket)
-                            panic("Could not store an object.");
-                        }
-                        if (cache_log_flag & CACHE_LOG_SYNC)
-                            write_err("cache_cleaner_worker: wrote object %s (size: %d bytes) (dirty: %d)",
-                                      tobj->objname != -1 ? ident_name(tobj->objname) : "not named", obj_size, tobj->dirty);
-                        tobj->dirty = 0;
+        LOCK_DIRTY("cache_cleaner_worker")
+        tobj = dirty.first;
+        while (tobj) {
+            cthis.u.objnum = tobj->objnum;
+            if (tobj->refs == 0 &&
+                !dict_contains(cleaner_ignore_dict, &cthis)) {
+                if (tobj->dead) {
+                    if (cache_log_flag & CACHE_LOG_DEAD_WRITE)
+                        write_err("cache_cleaner_worker: skipping dead object");
+                } else {
+                    if (!simble_put(tobj, tobj->objnum, &obj_size)) {
+                        UNLOCK_DIRTY("cache_cleaner_worker")
+                        panic("Could not store an object.");
                     }
-
-                    tobj2 = tobj->next_dirty;
-                    cache_remove_from_dirty(&dirty[cache_bucket], tobj);
-                    tobj = tobj2;
+                    if (cache_log_flag & CACHE_LOG_SYNC)
+                        write_err("cache_cleaner_worker: wrote object %s (size: %d bytes) (dirty: %d)",
+                                  tobj->objname != -1 ? ident_name(tobj->objname) : "not named", obj_size, tobj->dirty);
+                    tobj->dirty = 0;
                 }
-                else
-                    tobj = tobj->next_dirty;
-            }
 
-            UNLOCK_BUCKET("cache_cleaner_worker", cache_bucket)
-
-            if (++cache_bucket == cache_width)
-                cache_bucket = 0;
-        } while (!wrote_something && cache_bucket != start_bucket);
+                tobj2 = tobj->next_dirty;
+                cache_remove_from_dirty(tobj);
+                tobj = tobj2;
+            }
+            else
+                tobj = tobj->next_dirty;
+        }
+        UNLOCK_DIRTY("cache_cleaner_worker")
     }
 
     pthread_mutex_unlock(&cleaner_lock);
@@ -722,32 +1183,29 @@ void *cache_cleaner_worker(void *dummy)
  */
 void cache_sanity_check(void) {
 #if DISABLED
-    Int       i;
     Obj     * obj;
     VMState * task;
 
-    for (i = 0; i < cache_width; i++) {
-        for (obj = active[i].first; obj; obj = obj->next_obj) {
+    for (obj = active.first; obj; obj = obj->next_obj) {
 
-            /* check suspended tasks */
-            for (task = suspended; task != NULL; task = task->next) {
-                if (task->cur_frame->object->objnum == obj->objnum)
-                    goto end;
-            }
+        /* check suspended tasks */
+        for (task = suspended; task != NULL; task = task->next) {
+            if (task->cur_frame->object->objnum == obj->objnum)
+                goto end;
+        }
 
-            /* check preempted tasks */
-            for (task = preempted; task != NULL; task = task->next) {
-                if (task->cur_frame->object->objnum == obj->objnum)
-                    goto end;
-            }
+        /* check preempted tasks */
+        for (task = preempted; task != NULL; task = task->next) {
+            if (task->cur_frame->object->objnum == obj->objnum)
+                goto end;
+        }
 
-            /* ack, panic */
-            panic("Active object #%d at start of main loop.", (Int) obj->objnum);
+        /* ack, panic */
+        panic("Active object #%d at start of main loop.", (Int) obj->objnum);
 
-            /* label both for loops can jump to, skipping the panic */
+        /* label the for loops can jump to, skipping the panic */
 end:
-            ;
-        }
+        ;
     }
 #endif
 }
@@ -762,32 +1220,22 @@ end:
 
 #ifdef CLEAN_CACHE
 void cache_cleanup(void) {
-    Obj * obj;
+    Obj * obj,
+        * next;
     Int   i;
-    Long  obj_size;
 
-    for (i = 0; i < cache_width; i++) {
-        for (obj = inactive[i].first; obj; obj = obj->next_obj) {
+    for (i = 0; i < 2; i++) {
+        for (obj = inactive[i].first; obj; obj = next) {
+            next = obj->next_obj;
             obj->ucounter >>= 1;
             if (obj->ucounter > 0)
                 continue;
-            if (obj->objnum != INV_OBJNUM && obj->dirty) {
-                if (!simble_put(obj, obj->objnum, &obj_size))
-                    panic("Could not store an object.");
-                if (cache_log_flag & CACHE_LOG_CLEANUP)
-                    write_err("cache_cleanup: wrote object %s (size: %d bytes) (dirty: %d)",
-                              obj->objname != -1 ? ident_name(obj->objname) : "not named", obj_size, obj->dirty);
-                obj->dirty = 0;
-            }
-            if (obj->objnum != INV_OBJNUM) {
+            cache_evict(obj, FALSE, CACHE_LOG_CLEANUP, "cache_cleanup");
 #if DEBUG_CACHE
-                _icounter--;
-                fprintf(errfile,"<%d\n",_icounter);
+            fprintf(errfile,"<%d\n",_icounter);
 #endif
-                object_free(obj);
-                obj->objnum = INV_OBJNUM;
-                continue;
-            }
+            cache_remove_from_list(&inactive[i], obj);
+            cache_add_to_list_tail(&blank, obj);
         }
     }
 }
@@ -801,21 +1249,24 @@ void cache_cleanup(void) {
 //
 // Returned list will always be:
 //
-//    [WIDTH, DEPTH, ...]
+//    [SIZE, HOLDERS, [STRING]]
 //
-// where ... is currently a list of strings, where each string contains
-// characters representing objects, as:
+// where SIZE is the configured cache size, HOLDERS is how many objects it
+// actually holds room for right now, and STRING contains a character for
+// each object in the cache: the active ones first, then the protected and
+// probation queues, each from most to least recently used:
 //
 //    a=active to current task
 //    A=active and dirty
-//    i=inactive
-//    I=inactive and dirty
+//    p=inactive, protected
+//    P=inactive, protected and dirty
+//    i=inactive, on probation
+//    I=inactive, on probation and dirty
 //
 // -Brandon
 */
 
 cList * cache_info(int level) {
-    int     x;
     Obj   * obj;
     cList * out;
     cList * list;
@@ -823,38 +1274,86 @@ cList * cache_info(int level) {
     cStr  * str;
 
     out = list_new(3);
-    list = list_new(cache_width);
+    list = list_new(1);
     d = list_empty_spaces(out, 3);
     d[0].type = INTEGER;
-    d[0].u.val = cache_width;
+    d[0].u.val = cache_size;
     d[1].type = INTEGER;
-    d[1].u.val = cache_depth;
+    d[1].u.val = holders;
     d[2].type = LIST;
     d[2].u.list = list;
-    d = list_empty_spaces(list, cache_width);
-
-    for (x=0; x < cache_width; x++) {
-        str = string_new(cache_depth);
-        for (obj = active[x].first; obj; obj = obj->next_obj) {
-            if (obj->objnum != INV_OBJNUM) {
-                if (obj->dirty)
-                    str = string_addc(str, 'A');
-                else
-                    str = string_addc(str, 'a');
-            }
-        }
-        for (obj = inactive[x].first; obj; obj = obj->next_obj) {
-            if (obj->objnum != INV_OBJNUM) {
-                if (obj->dirty)
-                    str = string_addc(str, 'I');
-                else
-                    str = string_addc(str, 'i');
-             }
+    d = list_empty_spaces(list, 1);
+
+    str = string_new(holders);
+    for (obj = active.first; obj; obj = obj->next_obj) {
+        if (obj->objnum != INV_OBJNUM) {
+            if (obj->dirty)
+                str = string_addc(str, 'A');
+            else
+                str = string_addc(str, 'a');
         }
-        d[x].type = STRING;
-        d[x].u.str = str;
     }
+    for (obj = inactive[CACHE_PROTECTED].first; obj; obj = obj->next_obj) {
+        if (obj->dirty)
+            str = string_addc(str, 'P');
+        else
+            str = string_addc(str, 'p');
+    }
+    for (obj = inactive[CACHE_PROBATION].first; obj; obj = obj->next_obj) {
+        if (obj->dirty)
+            str = string_addc(str, 'I');
+        else
+            str = string_addc(str, 'i');
+    }
+    d[0].type = STRING;
+    d[0].u.str = str;
 
     return out;
 }
+
+/*
+// ----------------------------------------------------------------------
+//
+// Requires: Initialized cache.
+// Effects: returns the object cache statistics for cache_stats():
+//
+//    [POLICY, HITS, MISSES, GHOST_HITS, EVICTIONS, PROBATION, PROTECTED,
+//     GHOSTS, RESIDENT, BYTES]
+//
+// GHOST_HITS counts the misses which found a ghost, PROBATION and
+// PROTECTED the inactive objects on each queue.  RESIDENT is the
+// estimated bytes the cached objects take up and BYTES the limit on it,
+// zero for none.
+*/
+
+cList * object_cache_info(void) {
+    cList * entry;
+    cData * d;
+
+    entry = list_new(10);
+    d = list_empty_spaces(entry, 10);
+
+    d[0].type = SYMBOL;
+    d[0].u.symbol = ident_dup(*policy->name);
+    d[1].type = INTEGER;
+    d[1].u.val = cache_hits;
+    d[2].type = INTEGER;
+    d[2].u.val = cache_misses;
+    d[3].type = INTEGER;
+    d[3].u.val = cache_ghost_hits;
+    d[4].type = INTEGER;
+    d[4].u.val = cache_evictions;
+    d[5].type = INTEGER;
+    d[5].u.val = inactive[CACHE_PROBATION].count;
+    d[6].type = INTEGER;
+    d[6].u.val = inactive[CACHE_PROTECTED].count;
+    d[7].type = INTEGER;
+    d[7].u.val = ghost_count;
+    d[8].type = INTEGER;
+    d[8].u.val = cache_resident;
+    d[9].type = INTEGER;
+    d[9].u.val = cache_bytes;
+
+    return entry;
+}
 #undef _cache_
@@ -9,6 +9,7 @@
 #include <string.h>
 
 #include "cdc_pcode.h"
+#include "operators.h"
 #include "util.h"
 
 /* We use MALLOC_DELTA to keep instr_buf thirty-two bytes less than a power of
@@ -19,6 +20,10 @@
 #define JUMP_TABLE_START        (128 - MALLOC_DELTA)
 #define MAX_VARS                128
 
+/* switch statements with at least this many constant case values are
+ * dispatched through a table, see op_switch_table() */
+#define SWITCH_TABLE_MIN        4
+
 enum scatter_modes {
     SM_STANDARD,
     SM_OPTIONAL,
@@ -46,6 +51,7 @@ static Int new_jump_dest(void);
 static void set_jump_dest_here(Int dest);
 static Int id_list_size(Id_list *id_list);
 static Method *final_pass(Obj *object);
+static void fuse_opcodes(Method *method);
 
 /* Temporary instruction storage. */
 static Instr *instr_buf;
@@ -1824,6 +1830,7 @@ static Method *final_pass(Obj *object)
     method->m_flags  = MF_NONE;
     method->m_access = MS_PUBLIC;
     method->native   = -1;
+    method_init_caches(method);
 
     /* Set argument names. */
     method->num_args = id_list_size(the_prog->args->ids);
@@ -1924,7 +1931,107 @@ static Method *final_pass(Obj *object)
         i++;
     }
 
+    fuse_opcodes(method);
+
     method->refs = 1;
     return method;
 }
 
+/* Number of opcodes taken by the instruction at pc, with its arguments. */
+static Int instr_length(Long *opcodes, Int pc)
+{
+    Op_info *info = &op_table[opcodes[pc]];
+
+    return 1 + (info->arg1 ? 1 : 0) + (info->arg2 ? 1 : 0);
+}
+
+/* Returns the pc after the comparison and branch starting at pc, or -1 if
+ * there isn't one. */
+static Int fuse_cmp_jump(Long *opcodes, Int pc, Int end)
+{
+    if (pc + 1 >= end)
+        return -1;
+
+    switch (opcodes[pc]) {
+      case EQ: case NE: case '>': case GE: case '<': case LE:
+        break;
+      default:
+        return -1;
+    }
+
+    switch (opcodes[pc + 1]) {
+      case IF: case IF_ELSE: case CONDITIONAL: case WHILE:
+        return pc + 1 + instr_length(opcodes, pc + 1);
+      default:
+        return -1;
+    }
+}
+
+/* Requires: method->opcodes is fully translated.
+ * Modifies: method->opcodes.
+ * Effects: Replaces the first opcode of common sequences with the matching
+ *          superinstruction (see the end of ops/operators.c).  The rest of
+ *          the sequence is left alone, so jumps into it still work, and
+ *          every superinstruction takes the same arguments as the opcode it
+ *          replaces, so the code can be walked and decompiled as before.
+ *          unfused_opcode() maps them back. */
+static void fuse_opcodes(Method *method)
+{
+    Long * opcodes = method->opcodes;
+    Int    end = method->num_opcodes;
+    Int    pc, next, arg, tail, last = -1;
+
+    for (pc = 0; pc < end; last = opcodes[pc], pc = next) {
+        next = pc + instr_length(opcodes, pc);
+
+        switch (opcodes[pc]) {
+          case SET_LOCAL:
+            /* INCREMENT and DECREMENT look for the SET_LOCAL after them. */
+            if (next < end && opcodes[next] == POP &&
+                last != INCREMENT && last != DECREMENT)
+            {
+                opcodes[pc] = SET_LOCAL_POP;
+                next++;
+            }
+            break;
+
+          case GET_LOCAL:
+            if (next >= end)
+                break;
+            arg = opcodes[next];
+            if (arg != ZERO && arg != ONE && arg != INTEGER && arg != GET_LOCAL)
+                break;
+            tail = next + instr_length(opcodes, next);
+            if (tail >= end)
+                break;
+            if (arg != GET_LOCAL &&
+                (opcodes[tail] == '+' || opcodes[tail] == '-'))
+            {
+                opcodes[pc] = LOCAL_ARITH;
+                next = tail + 1;
+            } else if ((tail = fuse_cmp_jump(opcodes, tail, end)) != -1) {
+                opcodes[pc] = LOCAL_CMP_JUMP;
+                next = tail;
+            }
+            break;
+
+          case GET_OBJ_VAR:
+            if (next < end && opcodes[next] == START_ARGS) {
+                opcodes[pc] = OBJ_VAR_ARGS;
+                next++;
+            }
+            break;
+
+          case END:
+            arg = opcodes[opcodes[pc + 1]];
+            if (arg == FOR_LIST || arg == FOR_RANGE)
+                opcodes[pc] = END_FOR;
+            break;
+
+          case SWITCH:
+            if (switch_table_cases(method, pc, NULL) >= SWITCH_TABLE_MIN)
+                opcodes[pc] = SWITCH_TABLE;
+            break;
+        }
+    }
+}
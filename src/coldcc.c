@@ -28,6 +28,7 @@ extern pthread_t cleaner;
 #define OPT_COMP 0
 #define OPT_DECOMP 1
 #define OPT_PARTIAL 2
+#define OPT_REBLOCK 3
 
 Int    c_nowrite = 1;
 Int    c_opt = OPT_COMP;
@@ -90,6 +91,11 @@ int main(int argc, char **argv) {
         } else if (c_opt == OPT_PARTIAL) {
             write_err ("Opening database for partial compile...");
             compile_db(EXISTING_DB);
+        } else if (c_opt == OPT_REBLOCK) {
+            init_binary_db();
+            write_err ("Rewriting database with %d byte blocks...",
+                       new_block_size);
+            simble_reblock(new_block_size);
         }
     }
 
@@ -272,25 +278,38 @@ static void initialize(Int argc, char **argv) {
                 case 'p':
                     c_opt = OPT_PARTIAL;
                     break;
+                case 'r':
+                    c_opt = OPT_REBLOCK;
+                    break;
+                case 'k':
+                    argv += getarg(name, &buf, opt, argv, &argc, usage);
+                    new_block_size = atoi(buf);
+                    if (!VALID_BLOCK_SIZE(new_block_size)) {
+                        usage(name);
+                        printf("\n** Invalid block size: '%s'\n", buf);
+                        exit(0);
+                    }
+                    break;
                 case 's': {
                     char * p;
 
                     argv += getarg(name, &buf, opt, argv, &argc, usage);
                     p = buf;
-                    cache_width = atoi(p);
+                    cache_size = atoi(p);
                     while (*p && isdigit(*p))
                         p++;
+                    /* the old WIDTHxDEPTH form, still taken as their product */
                     if ((char) LCASE(*p) == 'x') {
                         p++;
-                        cache_depth = atoi(p);
-                    } else {
+                        cache_size *= atoi(p);
+                    } else if (*p) {
                         usage(name);
-                        printf("\n** Invalid WIDTHxDEPTH: '%s'\n", buf);
+                        printf("\n** Invalid cache size: '%s'\n", buf);
                         exit(0);
                     }
-                    if (cache_width == 0 && cache_depth == 0) {
+                    if (cache_size < 1) {
                         usage(name);
-                        puts("\n** The WIDTH and DEPTH cannot both be zero\n");
+                        puts("\n** The cache size must be at least 1\n");
                         exit(0);
                     }
                     break;
@@ -368,13 +387,18 @@ void usage (char * name) {
              "    +|-#            Print/Do not print object numbers by default.\n"
              "                    Default option is +#\n"
              "                    print object names by default, if they exist.\n"
-             "    -s WIDTHxDEPTH  Cache size, default %dx%d\n"
+             "    -s size         Cache size in objects, default %d\n"
+             "    -k size         Block size of a new binary db, a power of two\n"
+             "                    from %d to %d.  Default is %d.\n"
+             "    -r              Rewrite the binary db with the block size\n"
+             "                    given by -k, in place.\n"
              "    -n              List native method configuration.\n"
              "    +|-o            Print/Do not print objects as they are processed.\n"
              "    -W              Do not print warnings.\n"
              "\n\n",
              VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH, name, c_dir_binary, c_dir_textdump,
-             CACHE_WIDTH, CACHE_DEPTH);
+             CACHE_SIZE, MIN_BLOCK_SIZE, MAX_BLOCK_SIZE,
+             BLOCK_SIZE);
     fflush(stderr);
 }
 
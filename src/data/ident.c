@@ -33,6 +33,8 @@ Ident left_id, right_id, both_id;
 /* config options */
 Ident cachelog_id, cachewatch_id, cachewatchcount_id, cleanerwait_id, cleanerignore_id;
 Ident log_malloc_size_id, log_method_cache_id, cache_history_size_id;
+Ident read_budget_id, read_highwater_id, dns_cache_ttl_id, compact_budget_id;
+Ident cache_size_id, cache_policy_id, lru_id, twoq_id, cache_bytes_id;
 
 /* cache stats options */
 Ident ancestor_cache_id, method_cache_id, name_cache_id, object_cache_id;
@@ -126,6 +128,15 @@ void init_ident(void)
     log_malloc_size_id = ident_get("log_malloc_size");
     log_method_cache_id = ident_get("log_method_cache");
     cache_history_size_id = ident_get("cache_history_size");
+    read_budget_id = ident_get("read_budget");
+    read_highwater_id = ident_get("read_highwater");
+    dns_cache_ttl_id = ident_get("dns_cache_ttl");
+    compact_budget_id = ident_get("compact_budget");
+    cache_size_id = ident_get("cache_size");
+    cache_policy_id = ident_get("cache_policy");
+    lru_id = ident_get("lru");
+    twoq_id = ident_get("2q");
+    cache_bytes_id = ident_get("cache_bytes");
 
     ancestor_cache_id = ident_get("ancestor_cache");
     method_cache_id = ident_get("method_cache");
@@ -79,6 +79,7 @@ struct search_params {
 
 struct {
     Long stamp;
+    Long gen;
     cObjnum objnum;
     Ident name;
     Bool is_frob;
@@ -132,6 +133,15 @@ Long num_objects;
 static Long cur_stamp = 2;
 static Long cur_anc_stamp = 2;
 
+/* Partial method cache invalidation, see METHOD_GEN_SIZE.  An entry is
+ * only valid while the generation for its objnum is the one it was set
+ * with. */
+static Long method_gen[METHOD_GEN_SIZE];
+#define METHOD_GEN(objnum) method_gen[(uLong) (objnum) % METHOD_GEN_SIZE]
+
+/* Source of Obj->method_serial */
+uLong last_method_serial = 0;
+
 cList * ancestor_cache_info(void)
 {
     cList * entry;
@@ -446,6 +456,8 @@ void object_destroy(Obj *object) {
     cData *d2, cthat, cother;
 #endif
 
+    OBJECT_NEW_METHOD_SERIAL(object);
+
     if (object->children && list_length(object->children) != 0) {
         /* Invalidate the method cache if object is not a leaf object */
         method_cache_invalidate_all();
@@ -1390,7 +1402,8 @@ static Bool method_cache_check(cObjnum objnum, Ident name,
     i = (10 + objnum + (name << 4) + (is_frob << 8) + after) % METHOD_CACHE_SIZE;
     if (method_cache[i].stamp == cur_stamp && method_cache[i].objnum == objnum &&
         method_cache[i].name == name && method_cache[i].after == after &&
-        method_cache[i].loc != -1 && method_cache[i].is_frob==is_frob) {
+        method_cache[i].loc != -1 && method_cache[i].is_frob==is_frob &&
+        method_cache[i].gen == METHOD_GEN(objnum)) {
         method_cache_hits++;
         if (!method_cache[i].failed) {
             object = cache_retrieve(method_cache[i].loc);
@@ -1407,6 +1420,115 @@ static Bool method_cache_check(cObjnum objnum, Ident name,
     }
 }
 
+/*
+// -----------------------------------------------------------------------
+// Inline caches for message sends.  Each method keeps an open addressed
+// table of its send sites, keyed by the pc of the send, holding the last
+// SEND_CACHE_WAYS receivers seen there and the Method each resolved to.
+// A way is good while the method cache would still give the same answer
+// (cur_stamp and the receiver's generation have not moved) and the
+// defining object has not let go of its Method structures since
+// (method_serial).  Most sends only ever see one receiver, so a hit is
+// usually the first way.
+*/
+
+#define SEND_HASH(pc, size) (((uLong) (pc) * 31) & ((size) - 1))
+
+static SendCache * send_cache_site(Method *sender, Int pc) {
+    SendCache * site, * old;
+    Int         i, j, old_size;
+
+    if (sender->sends) {
+        for (i = SEND_HASH(pc, sender->sends_size);
+             sender->sends[i].pc;
+             i = (i + 1) & (sender->sends_size - 1)) {
+            if (sender->sends[i].pc == pc)
+                return &sender->sends[i];
+        }
+    }
+
+    /* a new site, keep the table at most half full */
+    if ((sender->sends_used + 1) * 2 > sender->sends_size) {
+        old = sender->sends;
+        old_size = sender->sends_size;
+        sender->sends_size = old_size ? old_size * 2 : 8;
+        sender->sends = EMALLOC(SendCache, sender->sends_size);
+        for (i = 0; i < sender->sends_size; i++)
+            sender->sends[i].pc = 0;
+        for (i = 0; i < old_size; i++) {
+            if (!old[i].pc)
+                continue;
+            for (j = SEND_HASH(old[i].pc, sender->sends_size);
+                 sender->sends[j].pc;
+                 j = (j + 1) & (sender->sends_size - 1));
+            sender->sends[j] = old[i];
+        }
+        if (old)
+            efree(old);
+    }
+
+    for (i = SEND_HASH(pc, sender->sends_size);
+         sender->sends[i].pc;
+         i = (i + 1) & (sender->sends_size - 1));
+    site = &sender->sends[i];
+    site->pc = pc;
+    site->next_way = 0;
+    for (j = 0; j < SEND_CACHE_WAYS; j++) {
+        site->way[j].objnum = INV_OBJNUM;
+        site->way[j].name = NOT_AN_IDENT;
+    }
+    sender->sends_used++;
+
+    return site;
+}
+
+/* object_find_method() for the send at pc in sender */
+Method *object_send_method(Method *sender, Int pc, cObjnum objnum,
+                           Ident name, Bool is_frob)
+{
+    SendCache * site = send_cache_site(sender, pc);
+    Method    * method;
+    Obj       * obj;
+    Int         i;
+
+    for (i = 0; i < SEND_CACHE_WAYS; i++) {
+        if (site->way[i].objnum == objnum && site->way[i].name == name &&
+            site->way[i].is_frob == is_frob)
+            break;
+    }
+
+    if (i < SEND_CACHE_WAYS) {
+        if (site->way[i].stamp == cur_stamp &&
+            site->way[i].gen == METHOD_GEN(objnum)) {
+            obj = cache_retrieve(site->way[i].loc);
+            if (obj && obj->method_serial == site->way[i].serial)
+                return site->way[i].method;
+            if (obj)
+                cache_discard(obj);
+        }
+    } else {
+        i = site->next_way;
+        site->next_way = (i + 1) % SEND_CACHE_WAYS;
+    }
+
+    method = object_find_method(objnum, name, is_frob);
+    if (!method)
+        return NULL;
+
+    if (site->way[i].name != NOT_AN_IDENT)
+        ident_discard(site->way[i].name);
+    site->way[i].objnum = objnum;
+    site->way[i].name = ident_dup(name);
+    site->way[i].is_frob = is_frob;
+    site->way[i].stamp = cur_stamp;
+    site->way[i].gen = METHOD_GEN(objnum);
+    site->way[i].loc = method->object->objnum;
+    site->way[i].serial = method->object->method_serial;
+    site->way[i].method = method;
+
+    return method;
+}
+
 static void method_cache_set(cObjnum objnum, Ident name, cObjnum after,
                              Long loc, Bool is_frob, Bool failed)
 {
@@ -1415,10 +1537,12 @@ static void method_cache_set(cObjnum objnum, Ident name, cObjnum after,
     i = (uLong)(10 + objnum + (name << 4) + (is_frob << 8) + after) % METHOD_CACHE_SIZE;
     if (method_cache[i].stamp != 0) {
       ident_discard(method_cache[i].name);
-      if (method_cache[i].stamp == cur_stamp)
+      if (method_cache[i].stamp == cur_stamp &&
+          method_cache[i].gen == METHOD_GEN(method_cache[i].objnum))
           method_cache_collisions++;
     }
     method_cache[i].stamp = cur_stamp;
+    method_cache[i].gen = METHOD_GEN(objnum);
     method_cache[i].objnum = objnum;
     method_cache[i].name = ident_dup(name);
     method_cache[i].after = after;
@@ -1437,7 +1561,8 @@ cList * method_cache_info() {
 
     used_buckets = 0;
     for (i = 0; i < METHOD_CACHE_SIZE; i++) {
-        if (method_cache[i].stamp == cur_stamp)
+        if (method_cache[i].stamp == cur_stamp &&
+            method_cache[i].gen == METHOD_GEN(method_cache[i].objnum))
             used_buckets++;
     }
 
@@ -1465,26 +1590,13 @@ cList * method_cache_info() {
 }
 
 static void method_cache_invalidate(cObjnum objnum) {
-#ifdef BUILDING_COLDCC
-    method_cache_invalidate_all();
-#else
-    uLong i;
-
     /*
-     * Invalidate cache entries by decrementing the stamp.
-     * Don't set it to 0, that way method_cache_set() can handle
-     * the ident_discard() properly
-     * Make sure that the stamp is already greater than 0
-     * to avoid false invalidations where objnum == 0, so
-     * it will catch all of the uninitialized entries in the
-     * cache, who will have objnum == 0, but also stamp == 0.
+     * Invalidate the entries for objnum (and any other objects sharing
+     * its generation) without touching the cache.  The stale entries
+     * keep their names, method_cache_set() will ident_discard() them
+     * when they are replaced.
      */
-    for (i = 0; i < METHOD_CACHE_SIZE; i++) {
-        if ((method_cache[i].objnum == objnum) &&
-            (method_cache[i].stamp > 0)) {
-            method_cache[i].stamp = 1;
-        }
-    }
+    METHOD_GEN(objnum)++;
 
     method_cache_partials++;
 
@@ -1492,7 +1604,6 @@ static void method_cache_invalidate(cObjnum objnum) {
         write_err("Method cache partially invalidated for obj #%l", objnum);
         log_current_task_stack(FALSE, write_err);
     }
-#endif
 }
 
 static void method_cache_invalidate_all(void) {
@@ -1643,7 +1754,9 @@ Int object_del_method(Obj *object, Ident name, Bool replacing) {
 
             cache_dirty_object(object);
 
-            /* ok, we can discard it. */
+            /* ok, we can discard it, and anything sending to it has to
+               look it up again */
+            OBJECT_NEW_METHOD_SERIAL(object);
             method_discard(object->methods->tab[ind].m);
             object->methods->tab[ind].m = NULL;
 
@@ -1739,17 +1852,65 @@ Method * method_new(void) {
     method->m_flags  = MF_NONE;
     method->m_access = MS_PUBLIC;
     method->native   = -1;
+    method_init_caches(method);
 
     /* usually everything else is initialized elsewhere */
     return method;
 }
 
+void method_init_caches(Method *method) {
+    method->sends = NULL;
+    method->sends_size = 0;
+    method->sends_used = 0;
+    method->switches = NULL;
+#ifdef USE_THREADED_DISPATCH
+    method->code = NULL;
+#endif
+}
+
+static void method_free_sends(Method *method) {
+    Int i, j;
+
+    if (!method->sends)
+        return;
+
+    for (i = 0; i < method->sends_size; i++) {
+        if (!method->sends[i].pc)
+            continue;
+        for (j = 0; j < SEND_CACHE_WAYS; j++) {
+            if (method->sends[i].way[j].name != NOT_AN_IDENT)
+                ident_discard(method->sends[i].way[j].name);
+        }
+    }
+    efree(method->sends);
+    method->sends = NULL;
+    method->sends_size = 0;
+    method->sends_used = 0;
+}
+
+static void method_free_switches(Method *method) {
+    SwitchTable *table;
+
+    while ((table = method->switches)) {
+        method->switches = table->next;
+        dict_discard(table->cases);
+        efree(table);
+    }
+}
+
 /* Destroys a method.  Does not delete references from the method's code. */
 void method_free(Method *method)
 {
     Int i, j;
     Error_list *elist;
 
+#ifdef USE_THREADED_DISPATCH
+    if (method->code)
+        efree(method->code);
+#endif
+    method_free_sends(method);
+    method_free_switches(method);
+
     if (method->name != -1)
         ident_discard(method->name);
     if (method->num_args)
@@ -613,6 +613,7 @@ static Method *unpack_method(cBuf *buf, Long *buf_pos)
     method->m_flags = read_long(buf, buf_pos);
     method->native = read_long(buf, buf_pos);
     method->refs = 1;
+    method_init_caches(method);
 
     method->num_args = read_long(buf, buf_pos);
     if (method->num_args) {
@@ -63,6 +63,7 @@ static Int prec_level(Int opcode);
 static char *binary_token(Int opcode);
 static cList *add_and_discard_string(cList *output, cStr *str);
 static char *varname(Int ind);
+static Long *unfused_opcodes(Method *method);
 
 /* These globals get set at the start and are never modified. */
 static Obj *the_object;
@@ -134,8 +135,35 @@ Int line_number(Method *method, Int pc) {
     if (count > 1)
         count++;
 
-    the_opcodes = method->opcodes;
-    return count + count_lines(0, pc, &flags);
+    the_opcodes = unfused_opcodes(method);
+    count += count_lines(0, pc, &flags);
+    TFREE(the_opcodes, method->num_opcodes);
+
+    return count;
+}
+
+/* Superinstructions (see fuse_opcodes() in codegen.c) are decompiled as the
+ * opcodes they were fused from, so we work on a copy with them undone. */
+static Long *unfused_opcodes(Method *method)
+{
+    Long    * opcodes = TMALLOC(Long, method->num_opcodes);
+    Op_info * info;
+    Int       i = 0;
+
+    while (i < method->num_opcodes) {
+        opcodes[i] = unfused_opcode(method->opcodes[i]);
+        info = &op_table[opcodes[i++]];
+        if (info->arg1) {
+            opcodes[i] = method->opcodes[i];
+            i++;
+        }
+        if (info->arg2) {
+            opcodes[i] = method->opcodes[i];
+            i++;
+        }
+    }
+
+    return opcodes;
 }
 
 static Int count_lines(Int start, Int end, unsigned *flags)
@@ -416,7 +444,7 @@ cList *decompile(Method *method, Obj *object, Int increment, int fflags)
     /* Set globals so we don't have to pass method and object around. */
     the_object = object;
     the_method = method;
-    the_opcodes = method->opcodes;
+    the_opcodes = unfused_opcodes(method);
     the_increment = increment;
     format_flags = fflags;
 
@@ -470,6 +498,7 @@ cList *decompile(Method *method, Obj *object, Int increment, int fflags)
 
     /* Free up all that memory we've been allocating and losing track of. */
     pfree(compiler_pile);
+    TFREE(the_opcodes, method->num_opcodes);
 
     return output;
 }
@@ -35,8 +35,8 @@ void init_defs(void) {
 
     logfile = stdout;
     errfile = stderr;
-    cache_width = CACHE_WIDTH;
-    cache_depth = CACHE_DEPTH;
+    cache_size = CACHE_SIZE;
+    cache_bytes = CACHE_BYTES;
 
 #ifdef HAVE_TM_ZONE
     time(&t);
@@ -56,6 +56,10 @@ void init_defs(void) {
 
     log_malloc_size = 0;
     log_method_cache = 0;
+    read_budget = READ_BUDGET;
+    read_highwater = READ_HIGHWATER;
+    dns_cache_ttl = DNS_CACHE_TTL;
+    compact_budget = COMPACT_BUDGET;
 
 #ifdef USE_CACHE_HISTORY
     ancestor_cache_history = list_new(0);
@@ -18,8 +18,70 @@
 #endif
 
 #include <ctype.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#ifdef USE_DNS_THREADS
+#include <pthread.h>
+#endif
+#include "cdc_pcode.h"
+#include "util.h"
+#include "net.h"
 #include "dns.h"
 
+#ifdef __UNIX__
+/*
+// The resolver threads call these as well, so they stick to
+// getnameinfo() and getaddrinfo() rather than the gethostby*()
+// functions, whose results live in static storage.
+*/
+
+/* out must be a DNS_MAXLEN character buffer */
+int lookup_name_by_ip(char * ip, char * out)
+{
+   struct sockaddr_in sin;
+
+   memset(&sin, 0, sizeof(sin));
+   sin.sin_family = AF_INET;
+   sin.sin_addr.s_addr = inet_addr(ip);
+   if (sin.sin_addr.s_addr == (in_addr_t) INVALID_INADDR)
+       return DNS_INVADDR;
+
+   switch (getnameinfo((struct sockaddr *) &sin, sizeof(sin),
+                       out, DNS_MAXLEN + 1, NULL, 0, NI_NAMEREQD)) {
+       case 0:
+           return DNS_NOERROR;
+#ifdef EAI_OVERFLOW
+       case EAI_OVERFLOW:
+           out[DNS_MAXLEN] = '\0';
+           return DNS_OVERFLOW;
+#endif
+       default:
+           return DNS_NORESOLV;
+   }
+}
+
+/* out must be a DNS_MAXLEN character buffer */
+int lookup_ip_by_name(char * name, char * out)
+{
+   struct addrinfo hints, * res;
+
+   memset(&hints, 0, sizeof(hints));
+   hints.ai_family = AF_INET;
+   hints.ai_socktype = SOCK_STREAM;
+
+   if (getaddrinfo(name, NULL, &hints, &res) || !res)
+       return DNS_NORESOLV;
+
+   inet_ntop(AF_INET, &((struct sockaddr_in *) res->ai_addr)->sin_addr,
+             out, DNS_MAXLEN + 1);
+   freeaddrinfo(res);
+
+   return DNS_NOERROR;
+}
+
+#else
+
 /* out must be a DNS_MAXLEN character buffer */
 int lookup_name_by_ip(char * ip, char * out)
 {
@@ -61,4 +123,377 @@ int lookup_ip_by_name(char * name, char * out)
    }
    return DNS_NOERROR;
 }
+#endif
+
+static int dns_resolve(int type, char * query, char * out) {
+    if (type == DNS_BY_IP)
+        return lookup_name_by_ip(query, out);
+    return lookup_ip_by_name(query, out);
+}
+
+/*
+// -----------------------------------------------------------------------
+// Answer cache.  Direct mapped, a new answer simply replaces whatever
+// was in its slot.  Only answers and "no such name" are kept; the rest
+// are either cheap to work out again or not worth remembering.
+*/
+
+typedef struct dns_entry_s {
+    int    type;                  /* DNS_BY_*, 0 if the slot is empty */
+    int    result;
+    time_t expires;
+    char   query[DNS_MAXLEN+1];
+    char   answer[DNS_MAXLEN+1];
+} dns_entry_t;
+
+static dns_entry_t dns_cache[DNS_CACHE_SIZE];
+
+static dns_entry_t * dns_cache_slot(int type, char * query) {
+    return &dns_cache[(hash_nullchar(query) + type) % DNS_CACHE_SIZE];
+}
+
+static dns_entry_t * dns_cache_find(int type, char * query) {
+    dns_entry_t * entry = dns_cache_slot(type, query);
+
+    if (dns_cache_ttl <= 0 || entry->type != type ||
+        entry->expires <= time(NULL) || strcmp(entry->query, query))
+        return NULL;
+
+    return entry;
+}
+
+static void dns_cache_store(int type, char * query, int result, char * answer)
+{
+    dns_entry_t * entry;
+    Int           ttl = dns_cache_ttl;
+
+    if (ttl <= 0)
+        return;
+    if (result == DNS_NORESOLV) {
+        if (ttl > DNS_NEGATIVE_TTL)
+            ttl = DNS_NEGATIVE_TTL;
+    } else if (result != DNS_NOERROR) {
+        return;
+    }
+
+    entry = dns_cache_slot(type, query);
+    entry->type = type;
+    entry->result = result;
+    entry->expires = time(NULL) + ttl;
+    strcpy(entry->query, query);
+    if (result == DNS_NOERROR)
+        strcpy(entry->answer, answer);
+    else
+        *entry->answer = '\0';
+}
+
+#ifdef USE_DNS_THREADS
+/*
+// -----------------------------------------------------------------------
+// Resolver threads.  The main thread queues a job and suspends the task
+// asking for it.  A worker takes the job off dns_queue, resolves it,
+// moves it to dns_done and writes a byte down dns_pipe, which wakes the
+// main loop so handle_dns_replies() can resume the task.  Tasks asking
+// for something already being looked up wait on the same job.
+//
+// Workers only touch the query, answer, result and error of their job,
+// and the queues under dns_lock.  Everything else, including memory
+// allocation and logging, happens in the main thread.
+//
+// A task is only resumed by its lookup if it is still in the suspension
+// it started waiting in; if something else resumed it meanwhile, the
+// answer is just cached.
+*/
+
+typedef struct dns_task_s dns_task_t;
+typedef struct dns_job_s  dns_job_t;
+
+struct dns_task_s {
+    Long         tid;
+    Long         suspension;     /* see vm_suspend() */
+    dns_task_t * next;
+};
+
+struct dns_job_s {
+    int          type;
+    int          result;
+    int          error;          /* errno if waking the main loop failed */
+    char         query[DNS_MAXLEN+1];
+    char         answer[DNS_MAXLEN+1];
+    dns_task_t * tasks;          /* waiting for the answer */
+    dns_job_t  * next;           /* on dns_queue or dns_done */
+    dns_job_t  * next_busy;      /* on dns_busy */
+};
+
+static pthread_mutex_t dns_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  dns_wake = PTHREAD_COND_INITIALIZER;
+static dns_job_t     * dns_queue = NULL;
+static dns_job_t    ** dns_queue_tail = &dns_queue;
+static dns_job_t     * dns_done = NULL;
+static Bool            dns_running = NO;
+
+/* main thread only */
+static dns_job_t     * dns_busy = NULL;  /* every job not yet replied to */
+static dns_task_t    * dns_waiting = NULL;  /* for dns_suspend() */
+static Int             dns_workers = 0;
+static int             dns_pipe[2] = {-1, -1};
+static io_watch_t      dns_watch;
+
+static void * dns_worker(void * arg) {
+    dns_job_t * job;
+    char        c = 0;
+
+    pthread_mutex_lock(&dns_lock);
+    while (dns_running) {
+        if (!dns_queue) {
+            pthread_cond_wait(&dns_wake, &dns_lock);
+            continue;
+        }
+        job = dns_queue;
+        if (!(dns_queue = job->next))
+            dns_queue_tail = &dns_queue;
+        pthread_mutex_unlock(&dns_lock);
+
+        job->result = dns_resolve(job->type, job->query, job->answer);
 
+        pthread_mutex_lock(&dns_lock);
+        job->next = dns_done;
+        dns_done = job;
+
+        /* if the pipe is full the main loop has plenty to wake it */
+        if (write(dns_pipe[1], &c, 1) == F_FAILURE && GETERR() != EAGAIN)
+            job->error = GETERR();
+    }
+    pthread_mutex_unlock(&dns_lock);
+
+    return NULL;
+}
+
+static void dns_request(int type, char * query) {
+    dns_job_t  * job;
+    dns_task_t * task, ** tp;
+
+    for (job = dns_busy; job; job = job->next_busy) {
+        if (job->type == type && !strcmp(job->query, query))
+            break;
+    }
+
+    if (!job) {
+        job = EMALLOC(dns_job_t, 1);
+        job->type = type;
+        job->error = 0;
+        strcpy(job->query, query);
+        job->tasks = NULL;
+        job->next = NULL;
+        job->next_busy = dns_busy;
+        dns_busy = job;
+
+        pthread_mutex_lock(&dns_lock);
+        *dns_queue_tail = job;
+        dns_queue_tail = &job->next;
+        pthread_cond_signal(&dns_wake);
+        pthread_mutex_unlock(&dns_lock);
+    }
+
+    /* first come, first resumed */
+    task = EMALLOC(dns_task_t, 1);
+    task->tid = task_id;
+    task->suspension = 0;
+    task->next = NULL;
+    for (tp = &job->tasks; *tp; tp = &(*tp)->next);
+    *tp = task;
+    dns_waiting = task;
+}
+#endif
+
+/*
+// -----------------------------------------------------------------------
+// Start the resolver threads.  If they cannot be started lookups are
+// made in-line, as coldcc always does.
+*/
+void init_dns(void) {
+#ifdef USE_DNS_THREADS
+    pthread_attr_t attr;
+    pthread_t      thread;
+    Int            i, flags;
+
+    if (pipe(dns_pipe) == F_FAILURE) {
+        write_err("init_dns: pipe(): %s", strerror(GETERR()));
+        return;
+    }
+    for (i = 0; i < 2; i++) {
+        flags = fcntl(dns_pipe[i], F_GETFL);
+        fcntl(dns_pipe[i], F_SETFL, flags | O_NONBLOCK);
+#ifdef FD_CLOEXEC
+        flags = fcntl(dns_pipe[i], F_GETFD);
+        fcntl(dns_pipe[i], F_SETFD, flags | FD_CLOEXEC);
+#endif
+    }
+
+    /* detached, uninit_dns() does not wait on a slow resolver */
+    dns_running = YES;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (i = 0; i < DNS_THREADS; i++) {
+        if (pthread_create(&thread, &attr, dns_worker, NULL))
+            break;
+        dns_workers++;
+    }
+    pthread_attr_destroy(&attr);
+
+    if (!dns_workers) {
+        write_err("init_dns: unable to start resolver threads");
+        dns_running = NO;
+        close(dns_pipe[0]);
+        close(dns_pipe[1]);
+        return;
+    }
+
+    io_event_watch(dns_pipe[0], &dns_watch, IO_WATCH_WAKEUP, NULL);
+#endif
+}
+
+/*
+// Stop the resolver threads.  Tasks still waiting on a lookup stay
+// suspended, and threads still in the resolver go when the process does.
+*/
+void uninit_dns(void) {
+#ifdef USE_DNS_THREADS
+    if (!dns_workers)
+        return;
+
+    io_event_unwatch(dns_pipe[0], &dns_watch);
+    dns_workers = 0;
+
+    pthread_mutex_lock(&dns_lock);
+    dns_running = NO;
+    pthread_cond_broadcast(&dns_wake);
+    pthread_mutex_unlock(&dns_lock);
+#endif
+}
+
+/*
+// -----------------------------------------------------------------------
+// Look something up for the current task.  out must be a DNS_MAXLEN
+// character buffer.  Returns DNS_PENDING if the task should suspend, in
+// which case the caller cleans up and calls dns_suspend(), and the task
+// is resumed with the answer (or the error from dns_failure()) once the
+// lookup is done.
+*/
+int dns_lookup(int type, char * query, char * out) {
+    dns_entry_t * entry;
+    int           result;
+
+    if (strlen(query) > DNS_MAXLEN)
+        return (type == DNS_BY_IP) ? DNS_INVADDR : DNS_NORESOLV;
+    if (type == DNS_BY_IP && inet_addr(query) == INVALID_INADDR)
+        return DNS_INVADDR;
+
+    if ((entry = dns_cache_find(type, query))) {
+        strcpy(out, entry->answer);
+        return entry->result;
+    }
+
+#ifdef USE_DNS_THREADS
+    if (dns_workers && !atomic) {
+        dns_request(type, query);
+        return DNS_PENDING;
+    }
+#endif
+
+    result = dns_resolve(type, query, out);
+    dns_cache_store(type, query, result, out);
+
+    return result;
+}
+
+/* Suspend the current task until the lookup dns_lookup() just returned
+   DNS_PENDING for is done. */
+void dns_suspend(void) {
+#ifdef USE_DNS_THREADS
+    dns_waiting->suspension = vm_suspend();
+    dns_waiting = NULL;
+#endif
+}
+
+/* What a failed lookup throws */
+cStr * dns_failure(int type, int result, char * query, Ident * error) {
+    switch (result) {
+        case DNS_INVADDR:
+            *error = address_id;
+            return format("Invalid IP Address: %s", query);
+        case DNS_OVERFLOW:
+            *error = range_id;
+            return format("DNS Response overflows DNS_MAXLEN!");
+        default:
+            *error = failed_id;
+            if (type == DNS_BY_IP)
+                return format("No name for IP Address %s", query);
+            return format("Address %s does not resolv", query);
+    }
+}
+
+/*
+// -----------------------------------------------------------------------
+// Called from the main loop: resume every task whose lookup has finished.
+*/
+void handle_dns_replies(void) {
+#ifdef USE_DNS_THREADS
+    dns_job_t  * job, * done, ** jp;
+    dns_task_t * task;
+    VMState    * vm;
+    cData        d;
+    cStr       * str = NULL;
+    Ident        error = NOT_AN_IDENT;
+    char         buf[64];
+
+    if (!dns_busy)
+        return;
+
+    while (read(dns_pipe[0], buf, sizeof(buf)) > 0);
+
+    pthread_mutex_lock(&dns_lock);
+    done = dns_done;
+    dns_done = NULL;
+    pthread_mutex_unlock(&dns_lock);
+
+    while ((job = done)) {
+        done = job->next;
+
+        if (job->error)
+            write_err("dns_worker: write(): %s", strerror(job->error));
+
+        for (jp = &dns_busy; *jp != job; jp = &(*jp)->next_busy);
+        *jp = job->next_busy;
+
+        dns_cache_store(job->type, job->query, job->result, job->answer);
+
+        if (job->result == DNS_NOERROR) {
+            d.type = STRING;
+            d.u.str = string_from_chars(job->answer, strlen(job->answer));
+        } else {
+            str = dns_failure(job->type, job->result, job->query, &error);
+        }
+
+        while ((task = job->tasks)) {
+            job->tasks = task->next;
+
+            /* it may have been cancelled, or resumed by someone else */
+            vm = vm_lookup(task->tid);
+            if (vm && vm->suspension == task->suspension) {
+                if (job->result == DNS_NOERROR)
+                    vm_resume(task->tid, &d);
+                else
+                    vm_resume_error(task->tid, error, str);
+            }
+            efree(task);
+        }
+
+        if (job->result == DNS_NOERROR)
+            data_discard(&d);
+        else
+            string_discard(str);
+        efree(job);
+    }
+#endif
+}
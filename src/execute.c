@@ -46,6 +46,9 @@ void clear_debug(void);
 cData debug;
 
 VMState *suspended = NULL, *preempted = NULL, *vmstore = NULL;
+static VMState *preempted_tail = NULL;
+static VMState *preempted_pass_end = NULL; /* last task of this pass */
+static Long suspensions = 0;     /* see vm_suspend() */
 VMStack *stack_store = NULL, *holder_cache = NULL;
 
 #define    call_error(_err_) { call_environ = _err_; return CALL_ERROR; }
@@ -53,26 +56,107 @@ VMStack *stack_store = NULL, *holder_cache = NULL;
 /*
 // ---------------------------------------------------------------
 //
-// These two defines add and remove tasks from task lists.
+// Push a VMState onto the free list.
 //
 */
 #define ADD_VM_TASK(the_list, the_value) { \
-        if (!the_list) { \
-            the_list = the_value; \
-            the_value->next = NULL; \
-        } else { \
-            the_value->next = the_list; \
-            the_list = the_value; \
-        } \
+        the_value->next = the_list; \
+        the_list = the_value; \
     }
 
-#define REMOVE_VM_TASK(the_list, the_value) { \
-        if (the_list == the_value) { \
-            the_list = the_list->next; \
-        } else { \
-            vm_delete(the_list, the_value); \
-        } \
+/*
+// ---------------------------------------------------------------
+//
+// Suspended and preempted tasks.  Every one of them is in task_table,
+// hashed on its task id, so finding one does not depend on how many
+// there are.  suspended is a doubly linked list, newest first, and
+// preempted is a queue run in the order the tasks paused; either way a
+// task can be taken off its list without searching for it.
+//
+*/
+#define TASK_TABLE_START 64
+#define TASK_HASH(tid) ((uLong) (tid) & (task_table_size - 1))
+
+static VMState ** task_table = NULL;
+static Int        task_table_size = 0;
+static Int        task_count = 0;
+
+static void task_table_grow(void) {
+    VMState ** old_table = task_table,
+             * vm,
+             * next;
+    Int        old_size = task_table_size,
+               i;
+
+    task_table_size = old_size ? old_size * 2 : TASK_TABLE_START;
+    task_table = EMALLOC(VMState *, task_table_size);
+    for (i = 0; i < task_table_size; i++)
+        task_table[i] = NULL;
+
+    for (i = 0; i < old_size; i++) {
+        for (vm = old_table[i]; vm; vm = next) {
+            next = vm->hash_next;
+            vm->hash_next = task_table[TASK_HASH(vm->task_id)];
+            task_table[TASK_HASH(vm->task_id)] = vm;
+        }
     }
+    if (old_table)
+        efree(old_table);
+}
+
+static void task_add(VMState *vm) {
+    VMState ** bucket;
+
+    if (task_count >= task_table_size)
+        task_table_grow();
+    bucket = &task_table[TASK_HASH(vm->task_id)];
+    vm->hash_next = *bucket;
+    *bucket = vm;
+    task_count++;
+
+    if (vm->preempted) {
+        vm->next = NULL;
+        vm->prev = preempted_tail;
+        if (preempted_tail)
+            preempted_tail->next = vm;
+        else
+            preempted = vm;
+        preempted_tail = vm;
+    } else {
+        vm->prev = NULL;
+        vm->next = suspended;
+        if (suspended)
+            suspended->prev = vm;
+        suspended = vm;
+    }
+}
+
+static void task_remove(VMState *vm) {
+    VMState ** bucket;
+
+    for (bucket = &task_table[TASK_HASH(vm->task_id)];
+         *bucket != vm;
+         bucket = &(*bucket)->hash_next);
+    *bucket = vm->hash_next;
+    task_count--;
+
+    if (vm->next)
+        vm->next->prev = vm->prev;
+    if (vm->prev) {
+        vm->prev->next = vm->next;
+    } else if (vm->preempted) {
+        preempted = vm->next;
+    } else {
+        suspended = vm->next;
+    }
+    if (vm->preempted) {
+        if (preempted_tail == vm)
+            preempted_tail = vm->prev;
+        if (preempted_pass_end == vm)
+            preempted_pass_end = vm->prev;
+    }
+    vm->next = vm->prev = vm->hash_next = NULL;
+}
 
 /*
 // ---------------------------------------------------------------
@@ -111,6 +195,7 @@ VMState * vm_current(void) {
     }
 
     vm->preempted = NO;
+    vm->suspension = 0;
     vm->cur_frame = cur_frame;
     vm->stack = stack;
     vm->stack_pos = stack_pos;
@@ -120,7 +205,7 @@ VMState * vm_current(void) {
     vm->arg_size = arg_size;
     vm->task_id = task_id;
     vm->frame_depth = frame_depth;
-    vm->next = NULL;
+    vm->next = vm->prev = vm->hash_next = NULL;
     vm->limit_datasize = limit_datasize;
     vm->limit_fork = limit_fork;
     vm->limit_recursion = limit_recursion;
@@ -167,27 +252,16 @@ static void restore_vm(VMState *vm) {
 }
 
 
-/*
-// ---------------------------------------------------------------
-*/
-static void vm_delete(VMState *list, VMState *elem) {
-    while (list && (list->next != elem))
-        list = list->next;
-    if (list)
-        list->next = elem->next;
-}
-
 /*
 // ---------------------------------------------------------------
 */
 VMState *vm_lookup(Long tid) {
     VMState * vm;
 
-    for (vm = suspended;  vm;  vm = vm->next)
-        if (vm->task_id == tid)
-            return vm;
+    if (!task_count)
+        return NULL;
 
-    for (vm = preempted;  vm;  vm = vm->next)
+    for (vm = task_table[TASK_HASH(tid)];  vm;  vm = vm->hash_next)
         if (vm->task_id == tid)
             return vm;
 
@@ -285,10 +359,12 @@ cList * vm_info(Long tid) {
 
 /*
 // ---------------------------------------------------------------
-// we assume tid is a non-preempted task
+// we assume tid is a non-preempted task.  If error is an ident the
+// task picks up by throwing it, rather than by getting ret back
+// from whatever suspended it.
 //
 */
-void vm_resume(Long tid, cData *ret) {
+static void resume_task(Long tid, cData *ret, Ident error, cStr *explanation) {
     VMState * vm = vm_lookup(tid),
             * old_vm;
 
@@ -296,23 +372,33 @@ void vm_resume(Long tid, cData *ret) {
         return;
     old_vm = vm_current();
     restore_vm(vm);
-    REMOVE_VM_TASK(suspended, vm);
+    task_remove(vm);
     ADD_VM_TASK(vmstore, vm);
-    if (ret) {
+    if (cur_frame->ticks < PAUSED_METHOD_TICKS)
+        cur_frame->ticks = PAUSED_METHOD_TICKS;
+    if (error != NOT_AN_IDENT) {
+        interp_error(error, explanation);
+    } else if (ret) {
         check_stack(1);
         data_dup(&stack[stack_pos], ret);
         stack_pos++;
     } else {
         push_int(0);
     }
-    if (cur_frame->ticks < PAUSED_METHOD_TICKS)
-        cur_frame->ticks = PAUSED_METHOD_TICKS;
     execute();
     store_stack();
     restore_vm(old_vm);
     ADD_VM_TASK(vmstore, old_vm);
 }
 
+void vm_resume(Long tid, cData *ret) {
+    resume_task(tid, ret, NOT_AN_IDENT, NULL);
+}
+
+void vm_resume_error(Long tid, Ident error, cStr *explanation) {
+    resume_task(tid, NULL, error, explanation);
+}
+
 /*
 // ---------------------------------------------------------------
 */
@@ -375,13 +461,20 @@ static Int fork_method(Obj * obj,
 
 /*
 // ---------------------------------------------------------------
+// Returns a number telling this suspension apart from any other, so
+// something the task is waiting on can check that it has not since
+// been resumed (and perhaps suspended again).
+//
 */
-void vm_suspend(void) {
+Long vm_suspend(void) {
     VMState * vm = vm_current();
 
-    ADD_VM_TASK(suspended, vm);
+    vm->suspension = ++suspensions;
+    task_add(vm);
     init_execute();
     cur_frame = NULL;
+
+    return vm->suspension;
 }
 
 #ifdef REF_COUNT_DEBUG
@@ -458,10 +551,7 @@ void vm_cancel(Long tid) {
     while (cur_frame)
         frame_return();
     if (old_vm != NULL) {
-        if (vm->preempted)
-            REMOVE_VM_TASK(preempted, vm)
-        else
-            REMOVE_VM_TASK(suspended, vm)
+        task_remove(vm);
         store_stack();
         ADD_VM_TASK(vmstore, vm);
         restore_vm(old_vm);
@@ -476,7 +566,7 @@ void vm_pause(void) {
     VMState * vm = vm_current();
 
     vm->preempted = YES;
-    ADD_VM_TASK(preempted, vm);
+    task_add(vm);
     init_execute();
     cur_frame = NULL;
 }
@@ -486,18 +576,18 @@ void vm_pause(void) {
 */
 void run_paused_tasks(void) {
     VMState * vm = vm_current(),
-            * task = preempted,
-            * last_task;
-
-    /* tasks preempting again will be on a new list */
-    preempted = NULL;
-
-    while (task) {
+            * task;
+
+    /* tasks preempting again go to the back of the queue, for next time;
+       the pass ends with the task which is at the back now, or with the
+       one before it if that is cancelled first */
+    preempted_pass_end = preempted_tail;
+    while (preempted_pass_end) {
+        task = preempted;
+        task_remove(task);
         restore_vm(task);
         cur_frame->ticks = PAUSED_METHOD_TICKS;
-        last_task = task;
-        task = task->next;
-        ADD_VM_TASK(vmstore, last_task);
+        ADD_VM_TASK(vmstore, task);
         execute();
         store_stack();
     }
@@ -515,21 +605,20 @@ void run_paused_tasks(void) {
 
 cList * vm_list(void) {
     cList  * r;
-    cData    elem;
+    cData  * elem;
     VMState * vm;
 
-    r = list_new(0);
-
-    elem.type = INTEGER;
+    r = list_new(task_count);
+    elem = list_empty_spaces(r, task_count);
 
-    for (vm = suspended; vm; vm = vm->next) {
-        elem.u.val = vm->task_id;
-        r = list_add(r, &elem);
+    for (vm = suspended; vm; vm = vm->next, elem++) {
+        elem->type = INTEGER;
+        elem->u.val = vm->task_id;
     }
 
-    for (vm = preempted; vm; vm = vm->next) {
-        elem.u.val = vm->task_id;
-        r = list_add(r, &elem);
+    for (vm = preempted; vm; vm = vm->next, elem++) {
+        elem->type = INTEGER;
+        elem->u.val = vm->task_id;
     }
 
     return r;
@@ -695,6 +784,11 @@ void uninit_execute(void) {
     efree(stack);
     efree(arg_starts);
 
+    if (task_table)
+        efree(task_table);
+    task_table = NULL;
+    task_table_size = task_count = 0;
+
     while (frame_store) {
         Frame *tmp = frame_store;
         frame_store = frame_store->caller_frame;
@@ -1069,6 +1163,104 @@ void dump_execute_profile(void) {
 #define MAX_NUM 2147483647
 #endif
 
+/* Charge the current frame the ticks of n more opcodes, for an opcode
+   which runs several at once, but leave it at least one, so that running
+   out is still left to execute(). */
+void charge_ticks(Int n) {
+#ifndef USE_THREADED_DISPATCH
+    while (n-- > 0 && cur_frame->ticks > 1) {
+        if (tick == MAX_NUM)
+            tick = -1;
+        tick++;
+        cur_frame->ticks--;
+    }
+#endif
+}
+
+#ifdef USE_THREADED_DISPATCH
+
+/*
+// ---------------------------------------------------------------
+//
+// Translate a method's opcodes into the op_table handlers which run them.
+// Operand slots are left NULL, they are never dispatched.
+//
+*/
+static Op_func *thread_method(Method *method) {
+    Op_info * info;
+    Int       i;
+
+    method->code = EMALLOC(Op_func, method->num_opcodes + 1);
+
+    i = 0;
+    while (i < method->num_opcodes) {
+        info = &op_table[method->opcodes[i]];
+        method->code[i++] = info->func;
+        if (info->arg1)
+            method->code[i++] = NULL;
+        if (info->arg2)
+            method->code[i++] = NULL;
+    }
+    method->code[method->num_opcodes] = NULL;
+
+    return method->code;
+}
+
+/*
+// ---------------------------------------------------------------
+//
+// Entering a frame (a call, a return to it, or resuming a task) and
+// jumping backwards are the only things which cost a tick; straight-line
+// code is bounded by the length of the method anyway.  We keep running
+// the same frame until an opcode replaces cur_frame.
+//
+*/
+static void execute(void) {
+    Frame   * frame;
+    Op_func * code;
+    Int       pc;
+
+    while (cur_frame) {
+        if (tick == MAX_NUM)
+            tick = -1;
+        tick++;
+        if ((--(cur_frame->ticks)) == 0) {
+            out_of_ticks_error();
+            continue;
+        }
+
+        frame = cur_frame;
+        code = frame->method->code;
+        if (!code)
+            code = thread_method(frame->method);
+
+        for (;;) {
+            pc = frame->pc;
+            frame->last_opcode = frame->opcodes[pc];
+            frame->pc++;
+
+#ifdef PROFILE_EXECUTE
+            update_execute_opcode(frame->last_opcode);
+#endif
+            (*code[pc])();
+
+            if (cur_frame != frame)
+                break;
+            if (frame->pc <= pc) {
+                if (tick == MAX_NUM)
+                    tick = -1;
+                tick++;
+                if ((--(frame->ticks)) == 0) {
+                    out_of_ticks_error();
+                    break;
+                }
+            }
+        }
+    }
+}
+
+#else
+
 static void execute(void) {
     Int opcode;
 
@@ -1104,6 +1296,8 @@ static void execute(void) {
     }
 }
 
+#endif
+
 /*
 // ---------------------------------------------------------------
 //
@@ -1122,7 +1316,7 @@ void anticipate_assignment(void) {
     while ((opcode = cur_frame->opcodes[pc]) == CRITICAL_END)
         pc++;
 
-    switch (opcode) {
+    switch (unfused_opcode(opcode)) {
       case SET_LOCAL:
         /* Zero out local variable value. */
         dp = &stack[cur_frame->var_start +
@@ -1283,8 +1477,13 @@ Int call_method(cObjnum objnum,     /* the object */
         cur_frame->object->objnum == objnum)
         is_frob = FROB_YES;
 
-    /* Find the method to run. */
-    method = object_find_method(objnum, name, is_frob);
+    /* Find the method to run.  When a frame is running this is one of
+       its sends, so go through the inline cache for that send site. */
+    if (cur_frame)
+        method = object_send_method(cur_frame->method, cur_frame->pc,
+                                    objnum, name, is_frob);
+    else
+        method = object_find_method(objnum, name, is_frob);
     if (!method) {
         if (is_frob == FROB_YES) {
             method = object_find_method(objnum, name, FROB_RETRY);
@@ -31,6 +31,7 @@ extern pthread_t cleaner;
 #include "file.h"
 #include "net.h"
 #include "sig.h"
+#include "dns.h"
 
 #ifdef __MSVC__
 #include <direct.h>
@@ -134,6 +135,7 @@ int main(int argc, char **argv) {
      * flush output buffers, and exit normally.
      */
     flush_defunct();
+    uninit_dns();
 #ifdef USE_CLEANER_THREAD
     pthread_cond_signal(&cleaner_condition);
     pthread_join(cleaner, NULL);
@@ -321,20 +323,21 @@ static void initialize(Int argc, char **argv) {
 
                 argv += getarg(name, &buf, opt, argv, &argc, usage);
                 p = buf;
-                cache_width = atoi(p);
+                cache_size = atoi(p);
                 while (*p && isdigit(*p))
                     p++;
+                /* the old WIDTHxDEPTH form, still taken as their product */
                 if ((char) LCASE(*p) == 'x') {
                     p++;
-                    cache_depth = atoi(p);
-                } else {
+                    cache_size *= atoi(p);
+                } else if (*p) {
                     usage(name);
-                    printf("\n** Invalid WIDTHxDEPTH: '%s'\n", buf);
+                    printf("\n** Invalid cache size: '%s'\n", buf);
                     exit(0);
                 }
-                if (cache_width == 0 && cache_depth == 0) {
+                if (cache_size < 1) {
                     usage(name);
-                 puts("\n** The WIDTH and DEPTH cannot both be zero\n");
+                    puts("\n** The cache size must be at least 1\n");
                     exit(0);
                 }
                 break;
@@ -401,6 +404,7 @@ static void initialize(Int argc, char **argv) {
     init_token();
     init_modules(argc, argv);
     init_net();
+    init_dns();
     init_instances();
 
     /* Figure out our hostname */
@@ -607,7 +611,18 @@ static void main_loop(void) {
                 break;
         }
 
+#ifdef USE_OBJECT_LOG
+        /* likewise while there are logged objects left to write back */
+        if (simble_checkpoint(CHECKPOINT_RECORDS))
+            seconds = 0;
+#endif
+
+        /* and while the objects file is being compacted */
+        if (simble_compact(compact_budget))
+            seconds = 0;
+
         handle_io_event_wait(seconds);
+        handle_dns_replies();
         handle_connection_input();
         handle_new_and_pending_connections();
 
@@ -649,7 +664,7 @@ Options:\n\n\
     -ld <file>  alternate database logfile, current: \"%s\"\n\
     -lg <file>  alternate driver (genesis) logfile, current: \"%s\"\n\
     -lp <file>  alternate runtime pid logfile, current: \"%s\"\n\
-    -s <size>   Cache size, given as WIDTHxDEPTH, current: %dx%d\n\
+    -s <size>   Cache size in objects, current: %d\n\
     -n <name>   specify the hostname (rather than looking it up)\n\
     -u <user>   if running as root, setuid to this user.  This only works\n\
                 in unix.  Genesis must first be run as root.\n\
@@ -664,8 +679,7 @@ Options:\n\n\
                     :23\n\n",
 
      VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH, name, c_dir_binary,
-     c_dir_root, c_dir_bin, c_logfile, c_errfile, c_runfile, cache_width,
-     cache_depth);
+     c_dir_root, c_dir_bin, c_logfile, c_errfile, c_runfile, cache_size);
 }
 
 /* TEMPORARY-- we need an area where identical functions 'names' (yet
@@ -161,6 +161,16 @@ extern Pile *compiler_pile;        /* We free this pile after compilation. */
 %token F_ANTICIPATE_ASSIGNMENT OP_HANDLED_FROB F_FROB_VALUE F_FROB_HANDLER F_SYNC F_CALLING_METHOD
 %token F_EXPLODE_QUOTED F_HAS_METHOD
 
+/*
+// Superinstructions, only ever produced by fuse_opcodes() in codegen.c.
+// Any token added before LAST_TOKEN moves FIRST_INSTANCE, and with it
+// the type numbers stored in binary databases, so it has to come with a
+// version bump in CMakeLists.txt for simble_verify_clean() to refuse
+// databases written with the old numbering.
+*/
+%token SET_LOCAL_POP LOCAL_ARITH LOCAL_CMP_JUMP OBJ_VAR_ARGS END_FOR
+%token SWITCH_TABLE
+
 /* Reserved for future use. */
 /*%token FORK*/
 
@@ -19,10 +19,21 @@
 #define DUMP_FINISHED        1
 #define DUMP_DUMPED_BLOCKS   0
 
+#define CHECKPOINT_RECORDS   64
+
+/* objects are stored in whole blocks; the size is chosen when a database
+   is created (coldcc -k) and kept in its 'clean' file */
+#define BLOCK_SIZE           256
+#define MIN_BLOCK_SIZE       16
+#define MAX_BLOCK_SIZE       65536
+#define VALID_BLOCK_SIZE(n)  ((n) >= MIN_BLOCK_SIZE && (n) <= MAX_BLOCK_SIZE \
+                              && !((n) & ((n) - 1)))
+
 void   init_binary_db(void);
 void   init_new_db(void);
 void   init_core_objects(void);
 Int    simble_get(Obj * object, cObjnum objnum, Long *obj_size);
+void   simble_prefetch(cObjnum * objnums, Int count);
 Int    simble_put(Obj * object, cObjnum objnum, Long *obj_size);
 Int    simble_check(cObjnum objnum);
 Int    simble_del(cObjnum objnum);
@@ -32,12 +43,19 @@ Float  simble_fragmentation(void);
 Int    simble_dump_start(char *dump_objects_filename);
 Int    simble_dump_some_blocks (Int maxblocks);
 void   simble_dump_finish(void);
+void   simble_reblock(Int new_size);
+Int    simble_compact(Int maxblocks);
+#ifdef USE_OBJECT_LOG
+Int    simble_checkpoint(Int maxrecords);
+#endif
 
 /* global primarily so we can know if we are dumping */
 #ifdef _binarydb_
 FILE *dump_db_file = NULL;
+Int   new_block_size = BLOCK_SIZE;  /* for init_new_db() */
 #else
 extern FILE *dump_db_file;
+extern Int   new_block_size;
 #endif
 
 #endif
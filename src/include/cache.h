@@ -18,9 +18,13 @@ void uninit_cache();
 #ifdef USE_DIRTY_LIST
 void cache_dirty_object(Obj *obj);
 #else
-#define cache_dirty_object(obj) obj->dirty=1
+#define cache_dirty_object(obj) ((obj)->dirty=1, (obj)->sized=0)
 #endif
 
+void cache_resize(Int size);
+void cache_set_bytes(Long bytes);
+Bool cache_set_policy(Ident name);
+Ident cache_policy(void);
 Obj *cache_get_holder(Long objnum);
 Obj *cache_retrieve(Long objnum);
 Obj *cache_grab(Obj *object);
@@ -32,6 +36,7 @@ void cache_sanity_check(void);
 void cache_cleanup(void);
 #endif
 cList * cache_info(int level);
+cList * object_cache_info(void);
 
 #endif
 
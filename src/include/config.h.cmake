@@ -4,8 +4,7 @@
 #define cdc_config_h
 
 #cmakedefine RESTRICTIVE_FILES
-#cmakedefine CACHE_WIDTH @CACHE_WIDTH@
-#cmakedefine CACHE_DEPTH @CACHE_DEPTH@
+#cmakedefine CACHE_SIZE @CACHE_SIZE@
 
 #cmakedefine VERSION_MAJOR @VERSION_MAJOR@
 #cmakedefine VERSION_MINOR @VERSION_MINOR@
@@ -19,6 +18,9 @@
 #cmakedefine SYSTEM_TYPE "@SYSTEM_TYPE@"
 
 #cmakedefine HAVE_UNISTD_H
+#cmakedefine HAVE_SYS_EPOLL_H
+#cmakedefine HAVE_LINUX_FS_H
+#cmakedefine HAVE_PTHREADS
 
 #cmakedefine DBM_H_FILE @DBM_H_FILE@
 
@@ -31,9 +33,12 @@
 #cmakedefine SIZEOF_DOUBLE @SIZEOF_DOUBLE@
 #cmakedefine SIZEOF_LDOUBLE @SIZEOF_LDOUBLE@
 
+#cmakedefine HAVE_COPY_FILE_RANGE
 #cmakedefine HAVE_GETRUSAGE
 #cmakedefine HAVE_GETTIMEOFDAY
 #cmakedefine HAVE_INET_ATON
+#cmakedefine HAVE_POSIX_FADVISE
+#cmakedefine HAVE_PREAD
 #cmakedefine HAVE_RINT
 #cmakedefine HAVE_STRCSPN
 #cmakedefine HAVE_STRERROR
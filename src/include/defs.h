@@ -79,6 +79,56 @@
 #  define PROFILE_EXECUTE
 #endif
 
+/*
+// ---------------------------------------------------------------------
+// Dispatch opcodes through a per-method table of handler addresses,
+// translated from the method's opcodes the first time it runs, instead
+// of looking each opcode up in op_table.  Ticks are then only charged for
+// calls, returns and backward jumps, so METHOD_TICKS bounds the number of
+// loop iterations and calls rather than the number of opcodes.
+*/
+#if DISABLED
+#  define USE_THREADED_DISPATCH
+#endif
+
+/*
+// ---------------------------------------------------------------------
+// Map the binary objects file read-only and decode objects straight out
+// of the mapping on a cache miss, rather than reading each one into a
+// freshly allocated buffer first.  Writes still go through pwrite; the
+// mapping is extended when the file grows.  Unix only.
+*/
+#if DISABLED
+#  define USE_MMAP_OBJECTS
+#endif
+
+/*
+// ---------------------------------------------------------------------
+// Write dirty objects to an append-only log (binary/log) and fsync only
+// that when syncing; the main loop folds logged objects into the objects
+// file afterwards.  A database which was not shut down cleanly is
+// recovered by replaying the log at startup.
+*/
+#if DISABLED
+#  define USE_OBJECT_LOG
+#endif
+
+/*
+// ---------------------------------------------------------------------
+// Write objects to the objects file from a writer thread.  simble_put()
+// still packs an object and finds it room, but only queues the packed
+// copy, so swapping a dirty object out of the cache never waits on the
+// disk.  Up to WRITEBACK_MAX bytes may be queued before it does.  Not
+// used with the object log, whose writes are appends already, with the
+// cleaner thread, or in coldcc.
+*/
+#if ENABLED && defined(HAVE_PTHREADS) && !defined(BUILDING_COLDCC) && \
+    !defined(USE_OBJECT_LOG) && !defined(USE_CLEANER_THREAD)
+#  define USE_WRITEBACK_THREAD
+#endif
+
+#define WRITEBACK_MAX 8388608
+
 /*
 // ---------------------------------------------------------------------
 // This is the number of methods it can record before having to flush
@@ -87,6 +137,42 @@
 */
 #define PROFILE_MAX 10000
 
+/*
+// ---------------------------------------------------------------------
+// Use epoll rather than select() to wait for network events.  epoll keeps
+// descriptors registered between passes of the main loop, so waiting does
+// not get slower as more players connect, and it is not limited to
+// FD_SETSIZE descriptors.  select() is still used if epoll is unavailable
+// at run-time, or <sys/epoll.h> was not found.
+*/
+#if ENABLED && defined(HAVE_SYS_EPOLL_H)
+#  define USE_EPOLL
+#endif
+
+/*
+// ---------------------------------------------------------------------
+// Resolve hostname() and ip() lookups on a pool of DNS_THREADS worker
+// threads.  The calling task is suspended until the answer comes back,
+// instead of the whole driver blocking in the resolver.  Without it (and
+// always in coldcc, or while atomic) lookups are made in-line as before.
+*/
+#if ENABLED && defined(HAVE_PTHREADS) && !defined(BUILDING_COLDCC)
+#  define USE_DNS_THREADS
+#endif
+
+#define DNS_THREADS 4
+
+/*
+// ---------------------------------------------------------------------
+// Answers from the resolver are kept in a DNS_CACHE_SIZE entry table for
+// DNS_CACHE_TTL seconds, the default for config('dns_cache_ttl).  Failed
+// lookups are remembered for at most DNS_NEGATIVE_TTL seconds.  A TTL of
+// zero turns the cache off.
+*/
+#define DNS_CACHE_SIZE   256
+#define DNS_CACHE_TTL    300
+#define DNS_NEGATIVE_TTL 30
+
 /*
 // ---------------------------------------------------------------------
 // This is what the core execution loop should wait (seconds), if no
@@ -112,6 +198,56 @@
 */
 #define OBJECT_PERSISTENCE 10
 
+/*
+// ---------------------------------------------------------------------
+// Eviction policy of the object cache: "lru", or "2q" which keeps a
+// sweep over the whole database (a text dump, a grep) from flushing the
+// objects in steady use.  This is the default for config('cache_policy).
+*/
+#define CACHE_POLICY "2q"
+
+/*
+// ---------------------------------------------------------------------
+// Most bytes the objects in the cache may take up in memory, as counted
+// by size_object(), before inactive ones are evicted to make room.  Zero
+// leaves only the cache_size limit on the number of objects.  This is
+// the default for config('cache_bytes).
+*/
+#define CACHE_BYTES 0
+
+/*
+// ---------------------------------------------------------------------
+// Most bytes read from a connection in one pass of the main loop.  It is
+// all handed to a single .parse() task, rather than one task for every
+// BIGBUF bytes.  Setting it to BIGBUF or less gives one read per pass.
+// This is the default for config('read_budget).
+*/
+#define READ_BUDGET 32768
+
+/*
+// ---------------------------------------------------------------------
+// The largest value config('read_budget) accepts.  A buffer of
+// read_budget bytes is kept around for reading, so it is bounded.
+*/
+#define MAX_READ_BUDGET 1048576
+
+/*
+// ---------------------------------------------------------------------
+// Most blocks of the objects file the main loop moves in one pass while
+// it is compacting the file.  Zero turns compaction off.  This is the
+// default for config('compact_budget).
+*/
+#define COMPACT_BUDGET 256
+
+/*
+// ---------------------------------------------------------------------
+// Once this many bytes have been given to .parse() while an earlier
+// .parse() task for the same connection is still suspended or preempted,
+// stop reading from the connection until that task finishes.  Zero turns
+// this off.  This is the default for config('read_highwater).
+*/
+#define READ_HIGHWATER 0
+
 /*
 // ---------------------------------------------------------------------
 // Number of ticks a method gets before dying with an E_TICKS.
@@ -153,6 +289,15 @@
 */
 #define METHOD_CACHE_SIZE 1000003
 
+/*
+// ---------------------------------------------------------------------
+// Changing the methods of a leaf object only invalidates its own method
+// cache entries.  Rather than search the cache for them, each object
+// hashes to one of these generation counters; bumping it invalidates the
+// entries for every object sharing the counter.  Use a prime.
+*/
+#define METHOD_GEN_SIZE 4099
+
 /*
 // ---------------------------------------------------------------------
 // size of ancestor cache. use prime numbers and follow guidelines as
@@ -461,8 +606,8 @@ Bool running;
 Bool atomic;
 Int  heartbeat_freq;
 
-Int cache_width;
-Int cache_depth;
+Int cache_size;
+Long cache_bytes;
 #ifdef USE_CLEANER_THREAD
 Int  cleaner_wait;
 cDict * cleaner_ignore_dict;
@@ -484,6 +629,10 @@ Int  cache_watch_count;
 cObjnum cache_watch_object;
 Int  log_malloc_size;
 Int  log_method_cache;
+Int  read_budget;
+Int  read_highwater;
+Int  dns_cache_ttl;
+Int  compact_budget;
 
 #ifdef USE_CACHE_HISTORY
 /* cache stats stuff */
@@ -515,8 +664,8 @@ extern Bool running;
 extern Bool atomic;
 extern Int  heartbeat_freq;
 
-extern Int cache_width;
-extern Int cache_depth;
+extern Int cache_size;
+extern Long cache_bytes;
 #ifdef USE_CLEANER_THREAD
 extern pthread_mutex_t cleaner_lock;
 extern pthread_cond_t cleaner_condition;
@@ -540,6 +689,10 @@ extern Int  cache_watch_count;
 extern cObjnum cache_watch_object;
 extern Int  log_malloc_size;
 extern Int  log_method_cache;
+extern Int  read_budget;
+extern Int  read_highwater;
+extern Int  dns_cache_ttl;
+extern Int  compact_budget;
 
 #ifdef USE_CACHE_HISTORY
 /* cache stats stuff */
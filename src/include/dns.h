@@ -17,6 +17,11 @@
 #define DNS_INVADDR                1
 #define DNS_NORESOLV                2
 #define DNS_OVERFLOW                3
+#define DNS_PENDING                4
+
+/* what dns_lookup() is asked for */
+#define DNS_BY_NAME                1
+#define DNS_BY_IP                2
 
 /* RFC 1035 defines the maximum length of a name as 255 octets */
 #define DNS_MAXLEN                255
@@ -30,5 +35,12 @@ int dns_error;
 int lookup_name_by_ip(char * ip, char * out);
 int lookup_ip_by_name(char * name, char * out);
 
+void   init_dns(void);
+void   uninit_dns(void);
+int    dns_lookup(int type, char * query, char * out);
+void   dns_suspend(void);
+cStr * dns_failure(int type, int result, char * query, Ident * error);
+void   handle_dns_replies(void);
+
 #endif
 
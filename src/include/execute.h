@@ -40,6 +40,7 @@ struct vmstate {
     Int       task_id;
     Int       frame_depth;
     Int       preempted;
+    Long      suspension;       /* set by vm_suspend(), 0 otherwise */
 #ifdef DRIVER_DEBUG
     cData     debug;
 #endif
@@ -48,7 +49,9 @@ struct vmstate {
     Int       limit_calldepth;
     Int       limit_recursion;
     Int       limit_objswap;
-    VMState * next;
+    VMState * next;             /* suspended, preempted or vmstore */
+    VMState * prev;
+    VMState * hash_next;        /* task_table chain */
 };
 
 struct task_s {
@@ -175,6 +178,7 @@ Int  frame_start(Obj *obj,
 void pop_native_stack(Int start);
 void frame_return(void);
 void anticipate_assignment(void);
+void charge_ticks(Int n);
 Int pass_method(Int stack_start, Int arg_start);
 Int call_method(cObjnum objnum, Ident message, Int stack_start, Int arg_start, Bool is_frob);
 void pop(Int n);
@@ -234,9 +238,10 @@ void pop_error_action_specifier(void);
 void pop_handler_info(void);
 cList *generate_traceback(Traceback_info *traceback);
 
-void      vm_suspend(void);
+Long      vm_suspend(void);
 cList   * vm_info(Long tid);
 void      vm_resume(Long tid, cData *ret);
+void      vm_resume_error(Long tid, Ident error, cStr *explanation);
 void      vm_cancel(Long tid);
 void      vm_pause(void);
 VMState * vm_lookup(Long tid);
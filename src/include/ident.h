@@ -34,6 +34,8 @@ extern Ident datasize_id, forkdepth_id, calldepth_id, recursion_id, objswap_id;
 /* driver config idents */
 extern Ident cachelog_id, cachewatch_id, cachewatchcount_id, cleanerwait_id, cleanerignore_id;
 extern Ident log_malloc_size_id, log_method_cache_id, cache_history_size_id;
+extern Ident read_budget_id, read_highwater_id, dns_cache_ttl_id, compact_budget_id;
+extern Ident cache_size_id, cache_policy_id, lru_id, twoq_id, cache_bytes_id;
 
 /* cache stats options */
 extern Ident ancestor_cache_id, method_cache_id, name_cache_id, object_cache_id;
@@ -9,17 +9,52 @@ typedef struct Conn Conn;
 typedef struct server_s     server_t;
 typedef struct pending_s    pending_t;
 
+/* What an io_watch_t is attached to */
+#define IO_WATCH_CONN    1
+#define IO_WATCH_SERVER  2
+#define IO_WATCH_PENDING 3
+#define IO_WATCH_WAKEUP  4
+
+/* Registration state kept by the I/O event backend (see net.c) for every
+   descriptor it watches.  owner points back to the Conn, server_t or
+   pending_t which contains it.  A wakeup descriptor has no owner, it only
+   interrupts the wait; whoever registered it drains it. */
+typedef struct io_watch_s {
+    Int    type;              /* IO_WATCH_* */
+    Int    events;            /* Events currently registered. */
+    void * owner;
+} io_watch_t;
+
 #include "net.h"
 
+/* A buffer queued for output on a connection.  The buffer is shared with
+   whatever wrote it, so it must not be changed while it is queued. */
+typedef struct out_seg_s out_seg_t;
+struct out_seg_s {
+    cBuf      * buf;
+    out_seg_t * next;
+};
+
 struct Conn {
     SOCKET fd;                /* File descriptor for input and output. */
-    cBuf * write_buf;     /* Buffer for network output. */
+    out_seg_t * write_head;   /* Queue of buffers for network output. */
+    out_seg_t * write_tail;
+    Int    write_offset;      /* Bytes of write_head already written. */
+    Int    write_len;         /* Total bytes waiting to be written. */
     cObjnum    objnum;       /* Object connection is associated with. */
+    Long   parse_task;        /* Latest .parse() task which has not finished,
+                                 or -1. */
+    Int    parse_backlog;     /* Bytes given to .parse() since it started. */
     struct {
         char readable;        /* Connection has new data pending. */
         char writable;        /* Connection can be written to. */
         char dead;            /* Connection is defunct. */
+        char datagram;        /* UDP; each read is a separate packet. */
+        char throttled;       /* Reading paused until .parse() catches up. */
     } flags;
+    io_watch_t watch;
+    Conn * next_ready;        /* Chain built by io_event_wait(). */
+    Conn * next_throttled;    /* Chain of throttled connections. */
     Conn * next;
 };
 
@@ -32,6 +67,7 @@ struct server_s {
     SOCKET         client_socket;
     char           client_addr[20];
     unsigned short client_port;
+    io_watch_t     watch;
     server_t     * next;
 };
 
@@ -41,6 +77,7 @@ struct pending_s {
     cObjnum objnum;
     Long error;
     Int finished;
+    io_watch_t watch;
     pending_t *next;
 };
 
@@ -14,6 +14,8 @@
 void    lookup_open(char *name, Int cnew);
 void    lookup_close(void);
 void    lookup_sync(void);
+Int     lookup_stage_objnums(void);
+Int     lookup_commit_objnums(void);
 Int     lookup_retrieve_objnum(cObjnum objnum, off_t *offset, Int *size);
 Int     lookup_store_objnum(cObjnum objnum, off_t offset, Int size);
 Int     lookup_remove_objnum(cObjnum objnum);
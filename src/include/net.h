@@ -22,7 +22,10 @@ typedef Int SOCKET;
 #endif
 
 Int io_event_wait(Int sec, Conn *connections, server_t *servers,
-                  pending_t *pendings);
+                  pending_t *pendings, Conn **ready);
+void io_event_watch(SOCKET fd, io_watch_t *watch, Int type, void *owner);
+void io_event_unwatch(SOCKET fd, io_watch_t *watch);
+void io_event_update_conn(Conn *conn);
 Long non_blocking_connect(char *addr, Int port, Int *socket_return);
 void init_net(void);
 void uninit_net(void);
@@ -71,14 +71,22 @@ struct Obj {
      * space. */
     ObjMethods *methods;
 
+    /* Changes whenever the Method structures in methods may have been
+     * freed, see object_send_method(). */
+    uLong       method_serial;
+
     /* Information for the cache. */
     Int         refs;
     uInt        dirty;                 /* Flag: Object has been modified. */
+    Long        resident;              /* Bytes in memory, see cache.c */
+    char        sized;                 /* Flag: resident is up to date */
+    Int         measure_wait;          /* Changes left until measured again */
 #ifdef CLEAN_CACHE
     Int         ucounter;              /* counter: Object references */
 #endif
     uLong       search;                /* Last cache search to visit this */
     char        dead;                  /* Flag: Object has been destroyed. */
+    uChar       queue;                 /* Inactive queue, see cache.c */
 
     /* Pointers to next and previous objects in cache chain. */
     Obj        *next_obj;
@@ -125,6 +133,39 @@ struct error_list {
     Int *error_ids;
 };
 
+/* Inline cache for one message send in a method: the last few receivers
+ * and the method each of them resolved to, see object_send_method(). */
+#define SEND_CACHE_WAYS 4
+
+typedef struct send_cache_s {
+    Int          pc;            /* of the send, 0 if this slot is unused */
+    Int          next_way;      /* the way to replace next */
+    struct {
+        cObjnum  objnum;
+        Ident    name;
+        Bool     is_frob;
+        Long     stamp;         /* cur_stamp when it was set */
+        Long     gen;           /* METHOD_GEN(objnum) when it was set */
+        cObjnum  loc;           /* where method is defined */
+        uLong    serial;        /* loc's method_serial when it was set */
+        Method * method;
+    } way[SEND_CACHE_WAYS];
+} SendCache;
+
+/* The case table for a SWITCH_TABLE at pc: the case values map to the pc
+ * of their case body, see op_switch_table(). */
+typedef struct switch_table_s SwitchTable;
+
+struct switch_table_s {
+    Int           pc;
+    Int           default_pc;
+    cDict       * cases;
+    SwitchTable * next;
+};
+
+/* an op_table handler, as run by execute() */
+typedef void (*Op_func)(void);
+
 struct Method {
     Ident name;
     Obj *object;
@@ -146,6 +187,19 @@ struct Method {
     Int m_access;       /* public, protected, private */
     Int m_flags;       /* overridable, synchronized, locked */
     Int refs;
+
+    /* inline caches for the sends in this method, hashed on their pc */
+    SendCache *sends;
+    Int sends_size;
+    Int sends_used;
+
+    /* case tables for its SWITCH_TABLE opcodes, built on first use */
+    SwitchTable *switches;
+
+#ifdef USE_THREADED_DISPATCH
+    /* op_table handlers for num_opcodes, built by execute() on first use */
+    Op_func *code;
+#endif
 };
 
 /* access: only one at a time */
@@ -213,6 +267,8 @@ extern Bool    object_put_var(Obj *object, cObjnum cclass, Ident name,
                               cData *val);
 extern Method *object_find_method(cObjnum objnum, Ident name, Bool is_frob);
 extern Method *object_find_method_local(Obj * obj, Ident name, Bool is_frob);
+extern Method *object_send_method(Method *sender, Int pc, cObjnum objnum,
+                                  Ident name, Bool is_frob);
 extern Method *object_find_next_method(cObjnum objnum, Ident name,
                                        cObjnum after, Bool is_frob);
 extern Int     object_rename_method(Obj * object, Ident oname, Ident nname);
@@ -221,6 +277,7 @@ extern Int     object_del_method(Obj *object, Ident name, Bool replacing);
 extern cList  *object_list_method(Obj *object, Ident name, Int indent,
                                   int fflags);
 extern Method *method_new(void);
+extern void    method_init_caches(Method *method);
 extern void    method_free(Method *method);
 extern Method *method_dup(Method *method);
 extern void    method_discard(Method *method);
@@ -238,6 +295,9 @@ extern void    object_load_parent_objs(Obj * obj);
 extern cList  *ancestor_cache_info(void);
 extern cList  *method_cache_info(void);
 
+extern uLong   last_method_serial;
+#define OBJECT_NEW_METHOD_SERIAL(obj) ((obj)->method_serial = ++last_method_serial)
+
 extern int     object_allocate_extra(
                    void (*cleanup_all) (void),
                    Int  (*cleanup)     (Obj * object, void * ptr));
@@ -22,6 +22,7 @@ extern Op_info op_table[LAST_TOKEN];
 void init_op_table(void);
 void uninit_op_table(void);
 Int find_function(char *name);
+Long unfused_opcode(Long opcode);
 
 #endif
 
@@ -89,5 +89,12 @@ void op_bwand(void);
 void op_bwor(void);
 void op_bwshr(void);
 void op_bwshl(void);
+void op_set_local_pop(void);
+void op_local_arith(void);
+void op_local_cmp_jump(void);
+void op_obj_var_args(void);
+void op_end_for(void);
+void op_switch_table(void);
+Int  switch_table_cases(Method *method, Int pc, SwitchTable *table);
 
 #endif
@@ -8,13 +8,23 @@
 
 #include <ctype.h>
 #include <string.h>
+#ifdef __UNIX__
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <limits.h>
+#endif
 #include "cdc_pcode.h"
 #include "util.h"
 #include "cache.h"
 #include "net.h"
 
 static void connection_read(Conn *conn);
+static void connection_parse_done(Conn *conn);
+static void check_throttled(void);
+static void throttle_remove(Conn *conn);
 static void connection_write(Conn *conn);
+static void connection_queue(Conn *conn, cBuf *buf);
+static void connection_consume(Conn *conn, Int len);
 static Conn *connection_add(Int fd, Long objnum);
 static void connection_discard(Conn *conn);
 static void pend_discard(pending_t *pend);
@@ -23,6 +33,10 @@ static void server_discard(server_t *serv);
 static Conn * connections;  /* List of client connections. */
 static server_t     * servers;      /* List of server sockets. */
 static pending_t    * pendings;     /* List of pending connections. */
+static Conn         * ready_conns;  /* Connections io_event_wait() found
+                                       readable or writable. */
+static Conn         * throttled_conns; /* Connections with reading paused,
+                                          chained by next_throttled. */
 
 /* it's safe to only initialize obj_extra_file in connection_add since
  * before then, no obj->extra's will contain a connection, and a extra
@@ -32,6 +46,22 @@ static pending_t    * pendings;     /* List of pending connections. */
 static int object_extra_initialized = 0;
 int object_extra_connection = -1;
 
+/* Output smaller than this is copied onto the end of the last queued
+   buffer, when nothing else shares it, instead of being queued on its
+   own; up to OUTPUT_MERGE_LIMIT bytes are merged into one buffer. */
+#define OUTPUT_MERGE_SIZE  BLOCK
+#define OUTPUT_MERGE_LIMIT IOBUF
+
+/* Most buffers handed to a single writev() */
+#ifdef IOV_MAX
+#  if IOV_MAX < 64
+#    define OUTPUT_IOV_MAX IOV_MAX
+#  endif
+#endif
+#ifndef OUTPUT_IOV_MAX
+#  define OUTPUT_IOV_MAX 64
+#endif
+
 /*
 // --------------------------------------------------------------------
 // Flush defunct connections and files.
@@ -44,10 +74,13 @@ void flush_defunct(void) {
     server_t     **servp, *serv;
     pending_t    **pendp, *pend;
 
+    /* the ready chain may point at connections we are about to free */
+    ready_conns = NULL;
+
     connp = &connections;
     while (*connp) {
         conn = *connp;
-        if (conn->flags.dead && conn->write_buf->len == 0) {
+        if (conn->flags.dead && conn->write_len == 0) {
             *connp = conn->next;
             connection_discard(conn);
         } else {
@@ -87,7 +120,9 @@ void flush_defunct(void) {
 */
 
 void handle_io_event_wait(Int seconds) {
-    io_event_wait(seconds, connections, servers, pendings);
+    if (throttled_conns)
+        check_throttled();
+    io_event_wait(seconds, connections, servers, pendings, &ready_conns);
 }
 
 /*
@@ -97,7 +132,7 @@ void handle_io_event_wait(Int seconds) {
 void handle_connection_input(void) {
     Conn * conn;
 
-    for (conn = connections; conn; conn = conn->next) {
+    for (conn = ready_conns; conn; conn = conn->next_ready) {
         if (conn->flags.readable && !conn->flags.dead)
             connection_read(conn);
     }
@@ -109,7 +144,7 @@ void handle_connection_input(void) {
 void handle_connection_output(void) {
     Conn * conn;
 
-    for (conn = connections; conn; conn = conn->next) {
+    for (conn = ready_conns; conn; conn = conn->next_ready) {
         if (conn->flags.writable)
             connection_write(conn);
     }
@@ -213,8 +248,10 @@ Conn * find_connection(Obj * obj) {
 Conn * ctell(Obj * obj, cBuf * buf) {
     Conn * conn = find_connection(obj);
 
-    if (conn != NULL)
-        conn->write_buf = buffer_append(conn->write_buf, buf);
+    if (conn != NULL) {
+        connection_queue(conn, buf);
+        io_event_update_conn(conn);
+    }
 
     return conn;
 }
@@ -228,6 +265,7 @@ Int boot(Obj * obj, void * ptr) {
 
     if (conn != NULL) {
         conn->flags.dead = 1;
+        io_event_update_conn(conn);
         return 1;
     }
 
@@ -268,8 +306,10 @@ Int tcp_server(Int port, char * ipaddr, Long objnum) {
         cnew->addr = string_new(0);
     cnew->objnum = objnum;
     cnew->dead = 0;
+    cnew->watch.type = 0;
     cnew->next = servers;
     servers = cnew;
+    io_event_watch(server_socket, &cnew->watch, IO_WATCH_SERVER, cnew);
 
     return TRUE;
 }
@@ -302,71 +342,230 @@ Int remove_server(Int port) {
     return 0;
 }
 
+/*
+// --------------------------------------------------------------------
+// Forget about the connection's .parse() task, it has finished, and
+// start reading from it again if it was throttled.
+*/
+static void connection_parse_done(Conn *conn) {
+    conn->parse_task = -1;
+    conn->parse_backlog = 0;
+    if (conn->flags.throttled) {
+        throttle_remove(conn);
+        io_event_update_conn(conn);
+    }
+}
+
+/*
+// --------------------------------------------------------------------
+// Take a connection off the throttled list.
+*/
+static void throttle_remove(Conn *conn) {
+    Conn ** connp;
+
+    for (connp = &throttled_conns; *connp; connp = &(*connp)->next_throttled) {
+        if (*connp == conn) {
+            *connp = conn->next_throttled;
+            break;
+        }
+    }
+    conn->flags.throttled = 0;
+    conn->next_throttled = NULL;
+}
+
+/*
+// --------------------------------------------------------------------
+// Only the throttled connections are looked at, not every connection.
+*/
+static void check_throttled(void) {
+    Conn * conn,
+         * next;
+
+    for (conn = throttled_conns; conn; conn = next) {
+        next = conn->next_throttled;
+        if (!vm_lookup(conn->parse_task))
+            connection_parse_done(conn);
+    }
+}
+
 /*
 // --------------------------------------------------------------------
 */
 /* rewrote to reduce buffer copies, by reading from the socket into a
    pre-allocated static buffer that we re-use.  -Brandon */
+/* Stream connections are read until they would block or read_budget
+   bytes have been read, and whatever was read goes to one .parse() task;
+   a client pasting a lot of text no longer starts a task per BIGBUF. */
 static void connection_read(Conn *conn) {
-    Int len;
+    Int len, r, want, budget;
+    Long tid;
     cData d;
 
+    budget = (read_budget > BIGBUF && !conn->flags.datagram) ?
+             read_budget : BIGBUF;
+
     /* DOH, something is still using out buffer, lets let
        it keep it and we'll get a new sandbox to play in */
     if (socket_buffer->refs > 1) {
         socket_buffer->refs--;
-        socket_buffer = buffer_new(BIGBUF);
+        socket_buffer = buffer_new(budget);
+    } else if (socket_buffer->size < budget) {
+        buffer_discard(socket_buffer);
+        socket_buffer = buffer_new(budget);
     }
 
-    len = SOCK_READ(conn->fd, (void *) socket_buffer->s, BIGBUF);
-    if (len == SOCKET_ERROR) {
-        if (GETERR() == ERR_INTR)
-            return;
+    len = 0;
+    do {
+        want = budget - len;
+        r = SOCK_READ(conn->fd, (void *) (socket_buffer->s + len), want);
+        if (r == SOCKET_ERROR) {
+            if (GETERR() == ERR_INTR && !len)
+                return;
+
+            /* hrm.. we got ERR_AGAIN, do nothing this time */
+            if (GETERR() == ERR_AGAIN || GETERR() == ERR_INTR)
+                break;
 
-        if (GETERR() != ERR_AGAIN) {
             /* The connection closed. */
             conn->flags.readable = 0;
             conn->flags.dead = 1;
-            return;
+            io_event_update_conn(conn);
+            if (!len)
+                return;
+            break;
+        } else if (r == 0) {
+            conn->flags.readable = 0;
+            conn->flags.dead = 1;
+            io_event_update_conn(conn);
+            break;
         }
-        /* hrm.. we got ERR_AGAIN, do nothing this time */
-        return;
-    } else if (len == 0) {
-        conn->flags.readable = 0;
-        conn->flags.dead = 1;
-    }
+        len += r;
+    } while (r == want && len < budget && !conn->flags.datagram);
 
     conn->flags.readable = 0;
 
-    /* We successfully read some data.  Handle it. */
-    socket_buffer->refs++;
+    /* An earlier .parse() task we were waiting on has finished */
+    if (conn->parse_task != -1 && !vm_lookup(conn->parse_task))
+        connection_parse_done(conn);
+
+    /* We successfully read some data.  Handle it.  A short read is
+       copied, so the database can hold onto it without also holding
+       onto a read_budget sized buffer. */
     socket_buffer->len = len;
     d.type = BUFFER;
-    d.u.buffer = socket_buffer;
+    if (len < BIGBUF && socket_buffer->size > BIGBUF)
+        d.u.buffer = buffer_append(buffer_new(len), socket_buffer);
+    else
+        d.u.buffer = buffer_dup(socket_buffer);
+    tid = task_id;
     vm_task(conn->objnum, parse_id, 1, &d);
-    socket_buffer->refs--;
+    buffer_discard(d.u.buffer);
+
+    /* Is the database keeping up with this connection? */
+    if (vm_lookup(tid))
+        conn->parse_task = tid;
+    if (conn->parse_task != -1) {
+        conn->parse_backlog += len;
+        if (read_highwater > 0 && conn->parse_backlog >= read_highwater &&
+            !conn->flags.throttled && !conn->flags.dead)
+        {
+            conn->flags.throttled = 1;
+            conn->next_throttled = throttled_conns;
+            throttled_conns = conn;
+            io_event_update_conn(conn);
+        }
+    }
+}
+
+/*
+// --------------------------------------------------------------------
+// Queue a buffer for output.  Buffers are queued by reference, so the
+// caller must not modify buf after this unless it checks buf->refs first
+// (as connection_read() does with socket_buffer).
+*/
+static void connection_queue(Conn *conn, cBuf *buf) {
+    out_seg_t * seg = conn->write_tail;
+
+    if (!buf->len)
+        return;
+
+    if (buf->len < OUTPUT_MERGE_SIZE && seg && seg->buf->refs == 1 &&
+        seg->buf->len + buf->len <= OUTPUT_MERGE_LIMIT)
+    {
+        seg->buf = buffer_append(seg->buf, buf);
+    } else {
+        seg = EMALLOC(out_seg_t, 1);
+        if (buf->len < OUTPUT_MERGE_SIZE)
+            seg->buf = buffer_append(buffer_new(buf->len), buf);
+        else
+            seg->buf = buffer_dup(buf);
+        seg->next = NULL;
+        if (conn->write_tail)
+            conn->write_tail->next = seg;
+        else
+            conn->write_head = seg;
+        conn->write_tail = seg;
+    }
+
+    conn->write_len += buf->len;
+}
+
+/*
+// --------------------------------------------------------------------
+// Drop len bytes from the front of the output queue.
+*/
+static void connection_consume(Conn *conn, Int len) {
+    out_seg_t * seg;
+
+    conn->write_len -= len;
+    len += conn->write_offset;
+
+    while ((seg = conn->write_head) != NULL && len >= seg->buf->len) {
+        len -= seg->buf->len;
+        conn->write_head = seg->next;
+        buffer_discard(seg->buf);
+        efree(seg);
+    }
+
+    if (!conn->write_head)
+        conn->write_tail = NULL;
+    conn->write_offset = len;
 }
 
 /*
 // --------------------------------------------------------------------
 */
 static void connection_write(Conn *conn) {
-    cBuf *buf = conn->write_buf;
+    out_seg_t * seg = conn->write_head;
     Int r;
+#ifdef __UNIX__
+    struct iovec iov[OUTPUT_IOV_MAX];
+    Int n, offset = conn->write_offset;
+
+    for (n = 0; seg && n < OUTPUT_IOV_MAX; seg = seg->next, n++) {
+        iov[n].iov_base = (void *) (seg->buf->s + offset);
+        iov[n].iov_len = seg->buf->len - offset;
+        offset = 0;
+    }
 
-    r = SOCK_WRITE(conn->fd, buf->s, buf->len);
+    r = writev(conn->fd, iov, n);
+#else
+    r = SOCK_WRITE(conn->fd, seg->buf->s + conn->write_offset,
+                   seg->buf->len - conn->write_offset);
+#endif
     conn->flags.writable = 0;
 
-    /* We lost the connection. */
-    if ((r == SOCKET_ERROR) && (GETERR() != ERR_AGAIN)) {
-       conn->flags.dead = 1;
-       buf = buffer_resize(buf, 0);
+    if (r == SOCKET_ERROR) {
+        /* We lost the connection. */
+        if (GETERR() != ERR_AGAIN) {
+            conn->flags.dead = 1;
+            connection_consume(conn, conn->write_len);
+        }
     } else {
-       MEMMOVE(buf->s, buf->s + r, buf->len - r);
-       buf = buffer_resize(buf, buf->len - r);
+        connection_consume(conn, r);
     }
 
-    conn->write_buf = buf;
+    io_event_update_conn(conn);
 }
 
 /*
@@ -374,6 +573,8 @@ static void connection_write(Conn *conn) {
 */
 static Conn * connection_add(Int fd, Long objnum) {
     Conn * conn;
+    int type = SOCK_STREAM;
+    socklen_t type_len = sizeof(type);
 
     if (!object_extra_initialized) {
         object_extra_initialized = 1;
@@ -382,20 +583,33 @@ static Conn * connection_add(Int fd, Long objnum) {
 
     /* clear old connections to this objnum */
     for (conn = connections; conn; conn = conn->next) {
-        if (conn->objnum == objnum && !conn->flags.dead)
+        if (conn->objnum == objnum && !conn->flags.dead) {
             conn->flags.dead = 1;
+            io_event_update_conn(conn);
+        }
     }
 
     /* initialize new connection */
     conn = EMALLOC(Conn, 1);
     conn->fd = fd;
-    conn->write_buf = buffer_new(0);
+    conn->write_head = conn->write_tail = NULL;
+    conn->write_offset = 0;
+    conn->write_len = 0;
     conn->objnum = objnum;
+    conn->parse_task = -1;
+    conn->parse_backlog = 0;
     conn->flags.readable = 0;
     conn->flags.writable = 0;
     conn->flags.dead = 0;
+    getsockopt(fd, SOL_SOCKET, SO_TYPE, (char *) &type, &type_len);
+    conn->flags.datagram = (type == SOCK_DGRAM);
+    conn->flags.throttled = 0;
+    conn->next_throttled = NULL;
+    conn->watch.type = 0;
+    conn->next_ready = NULL;
     conn->next = connections;
     connections = conn;
+    io_event_watch(fd, &conn->watch, IO_WATCH_CONN, conn);
 
     return conn;
 }
@@ -417,8 +631,11 @@ static void connection_discard(Conn *conn) {
     }
 
     /* Free the data associated with the connection. */
+    if (conn->flags.throttled)
+        throttle_remove(conn);
+    io_event_unwatch(conn->fd, &conn->watch);
     SOCK_CLOSE(conn->fd);
-    buffer_discard(conn->write_buf);
+    connection_consume(conn, conn->write_len);
     efree(conn);
 
     /* Notify connection object that the connection is gone */
@@ -436,6 +653,7 @@ static void pend_discard(pending_t *pend) {
 // --------------------------------------------------------------------
 */
 static void server_discard(server_t *serv) {
+    io_event_unwatch(serv->server_socket, &serv->watch);
     SOCK_CLOSE(serv->server_socket);
     string_discard(serv->addr);
     efree(serv);
@@ -458,8 +676,11 @@ Long make_connection(char *addr, Int port, cObjnum receiver) {
     cnew->objnum = receiver;
     cnew->finished = 0;
     cnew->error = result;
+    cnew->watch.type = 0;
     cnew->next = pendings;
     pendings = cnew;
+    if (result == NOT_AN_IDENT)
+        io_event_watch(socket, &cnew->watch, IO_WATCH_PENDING, cnew);
     return NOT_AN_IDENT;
 }
 
@@ -477,8 +698,11 @@ Long make_udp_connection(char *addr, Int port, cObjnum receiver) {
     cnew->objnum = receiver;
     cnew->finished = 0;
     cnew->error = result;
+    cnew->watch.type = 0;
     cnew->next = pendings;
     pendings = cnew;
+    if (result == NOT_AN_IDENT)
+        io_event_watch(socket, &cnew->watch, IO_WATCH_PENDING, cnew);
     return NOT_AN_IDENT;
 }
 
@@ -490,25 +714,37 @@ Long make_udp_connection(char *addr, Int port, cObjnum receiver) {
 
 void flush_output(void) {
     Conn  * conn;
+    out_seg_t * seg;
     unsigned char * s;
     Int len, r;
 
     /* do connections */
     for (conn = connections; conn; conn = conn->next) {
-        s = conn->write_buf->s;
-        len = conn->write_buf->len;
-        while (len) {
-            r = SOCK_WRITE(conn->fd, s, len);
-            if ((r == SOCKET_ERROR) && (GETERR() != ERR_AGAIN))
+        s = NULL;
+        len = 0;
+        for (seg = conn->write_head; seg; seg = seg->next) {
+            if (seg == conn->write_head) {
+                s = seg->buf->s + conn->write_offset;
+                len = seg->buf->len - conn->write_offset;
+            } else {
+                s = seg->buf->s;
+                len = seg->buf->len;
+            }
+            while (len) {
+                r = SOCK_WRITE(conn->fd, s, len);
+                if ((r == SOCKET_ERROR) && (GETERR() != ERR_AGAIN))
+                    break;
+                /*
+                 * If it would've blocked, then don't change len or s,
+                 * so set the bytes written to 0
+                 */
+                if ((r == SOCKET_ERROR) && (GETERR() == ERR_AGAIN))
+                    r = 0;
+                len -= r;
+                s += r;
+            }
+            if (len)
                 break;
-            /*
-             * If it would've blocked, then don't change len or s,
-             * so set the bytes written to 0
-             */
-            if ((r == SOCKET_ERROR) && (GETERR() == ERR_AGAIN))
-                r = 0;
-            len -= r;
-            s += r;
         }
     }
 }
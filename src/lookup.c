@@ -1,7 +1,10 @@
 /*
 // Full copyright information is available in the file ../doc/CREDITS
 //
-// Interface to dbm index of object locations.
+// Index of object locations.  Object numbers are small and dense, so
+// their (offset, size) pairs live in an array indexed by objnum which is
+// kept in memory and written back to a flat file ("index.objnum") when
+// the database is synced.  Object names stay in the dbm index.
 */
 
 #include "defs.h"
@@ -57,24 +60,66 @@ pthread_mutex_t lookup_mutex;
 Int name_cache_hits = 0;
 Int name_cache_misses = 0;
 
+typedef struct _offset_size _offset_size;
+struct _offset_size {
+    off_t offset;
+    Int   size;                 /* 0 if there is no such object */
+};
+
 static datum objnum_key(cObjnum objnum, Number_buf nbuf);
 static datum name_key(Ident name);
-static datum offset_size_value(off_t offset, Int size, Number_buf nbuf);
 static void parse_offset_size_value(datum value, off_t *offset, Int *size);
 static datum objnum_value(cObjnum objnum, Number_buf nbuf);
+static void open_objnums(char *name, Int cnew);
+static void import_objnums(char *path);
+static Int  write_objnums(char *path, Long end);
+static void grow_objnums(cObjnum objnum);
+static void sync_objnums(void);
 static void sync_name_cache(void);
 static Int store_name(Ident name, cObjnum objnum);
 static Int get_name(Ident name, cObjnum *objnum);
 
 static DBM *dbp;
 
+static int            objnum_fd = -1;
+static _offset_size * objnums = NULL;
+static cObjnum        objnums_size = 0;   /* entries allocated */
+static cObjnum        objnums_cursor;     /* lookup_{first,next}_objnum */
+static cObjnum        dirty_low, dirty_high;  /* [low, high) not on disk */
+
+#define mark_dirty(__o) { \
+        if (dirty_low >= dirty_high) { \
+            dirty_low = (__o); \
+            dirty_high = (__o) + 1; \
+        } else if ((__o) < dirty_low) \
+            dirty_low = (__o); \
+        else if ((__o) >= dirty_high) \
+            dirty_high = (__o) + 1; \
+    }
+
 struct name_cache_entry {
     Ident   name;
     cObjnum objnum;
     char    dirty;
     char    on_disk;
+    char    listed;             /* in dirty_names[] */
 } name_cache[NAME_CACHE_SIZE + 1];
 
+/* slots which may need writing at the next sync, so it need not scan */
+static Int dirty_names[NAME_CACHE_SIZE];
+static Int dirty_names_count;
+
+/* set when the dbm has been written since it was last opened */
+static Int dbm_changed;
+
+#define mark_name_dirty(__i) { \
+        name_cache[__i].dirty = 1; \
+        if (!name_cache[__i].listed) { \
+            name_cache[__i].listed = 1; \
+            dirty_names[dirty_names_count++] = (__i); \
+        } \
+    }
+
 void lookup_open(char *name, Int cnew) {
     Int i;
 
@@ -89,13 +134,25 @@ void lookup_open(char *name, Int cnew) {
     if (!dbp)
         fail_to_start("Cannot open dbm database file.");
 
-    for (i = 0; i < NAME_CACHE_SIZE; i++)
+    for (i = 0; i < NAME_CACHE_SIZE; i++) {
         name_cache[i].name = NOT_AN_IDENT;
+        name_cache[i].listed = 0;
+    }
+    dirty_names_count = 0;
+    dbm_changed = 0;
+
+    open_objnums(name, cnew);
 }
 
 void lookup_close(void) {
     sync_name_cache();
     dbm_close(dbp);
+    sync_objnums();
+    close(objnum_fd);
+    objnum_fd = -1;
+    efree(objnums);
+    objnums = NULL;
+    objnums_size = 0;
 }
 
 void lookup_sync(void) {
@@ -105,10 +162,16 @@ void lookup_sync(void) {
 
     LOCK_LOOKUP("lookup_sync");
 
-    /* Only way to do this with ndbm is close and re-open. */
     sync_name_cache();
-    dbm_close(dbp);
-    dbp = dbm_open(buf, O_RDWR | O_CREAT | O_BINARY, READ_WRITE);
+
+    /* Only way to flush ndbm is close and re-open, so only do it when
+       something was actually written to it since the last time. */
+    if (dbm_changed) {
+        dbm_close(dbp);
+        dbp = dbm_open(buf, O_RDWR | O_CREAT | O_BINARY, READ_WRITE);
+        dbm_changed = 0;
+    }
+    sync_objnums();
 
     UNLOCK_LOOKUP("lookup_sync");
 
@@ -118,56 +181,51 @@ void lookup_sync(void) {
 
 Int lookup_retrieve_objnum(cObjnum objnum, off_t *offset, Int *size)
 {
-    datum key, value;
-    Number_buf nbuf;
-
     LOCK_LOOKUP("lookup_retrieve_objnum");
 
-    /* Get the value for objnum from the database. */
-    key = objnum_key(objnum, nbuf);
-    value = dbm_fetch(dbp, key);
-    if (!value.dptr)
-    {
+    if (objnum < 0 || objnum >= objnums_size || !objnums[objnum].size) {
         UNLOCK_LOOKUP("lookup_retrieve_objnum");
         return 0;
     }
 
-    parse_offset_size_value(value, offset, size);
+    *offset = objnums[objnum].offset;
+    *size = objnums[objnum].size;
     UNLOCK_LOOKUP("lookup_retrieve_objnum");
     return 1;
 }
 
 Int lookup_store_objnum(cObjnum objnum, off_t offset, Int size)
 {
-    datum key, value;
-    Number_buf nbuf1, nbuf2;
-
     LOCK_LOOKUP("lookup_store_objnum");
-    key = objnum_key(objnum, nbuf1);
-    value = offset_size_value(offset, size, nbuf2);
-    if (dbm_store(dbp, key, value, DBM_REPLACE)) {
+    if (objnum < 0 || size <= 0) {
         write_err("ERROR: Failed to store key %l.", objnum);
         UNLOCK_LOOKUP("lookup_store_objnum");
         return 0;
     }
 
+    if (objnum >= objnums_size)
+        grow_objnums(objnum);
+    objnums[objnum].offset = offset;
+    objnums[objnum].size = size;
+    mark_dirty(objnum);
+
     UNLOCK_LOOKUP("lookup_store_objnum");
     return 1;
 }
 
 Int lookup_remove_objnum(cObjnum objnum)
 {
-    datum key;
-    Number_buf nbuf;
-
     LOCK_LOOKUP("lookup_remove_objnum");
-    /* Remove the key from the database. */
-    key = objnum_key(objnum, nbuf);
-    if (dbm_delete(dbp, key)) {
+    if (objnum < 0 || objnum >= objnums_size || !objnums[objnum].size) {
         write_err("ERROR: Failed to delete key %l.", objnum);
         UNLOCK_LOOKUP("lookup_remove_objnum");
         return 0;
     }
+
+    objnums[objnum].offset = 0;
+    objnums[objnum].size = 0;
+    mark_dirty(objnum);
+
     UNLOCK_LOOKUP("lookup_remove_objnum");
     return 1;
 }
@@ -175,27 +233,18 @@ Int lookup_remove_objnum(cObjnum objnum)
 /* only called during startup, nothing can be dirty so no chance the cleaner can call it */
 cObjnum lookup_first_objnum(void)
 {
-    datum key;
-
-    key = dbm_firstkey(dbp);
-    if (key.dptr == NULL)
-        return INV_OBJNUM;
-    if (key.dsize > 1 && *(char*)key.dptr == 0)
-        return atoln(key.dptr + 1, key.dsize - 1);
+    objnums_cursor = -1;
     return lookup_next_objnum();
 }
 
 /* only called during startup, nothing can be dirty so no chance the cleaner can call it */
 cObjnum lookup_next_objnum(void)
 {
-    datum key;
-
-    key = dbm_nextkey(dbp);
-    if (key.dptr == NULL)
-        return NOT_AN_IDENT;
-    if (key.dsize > 1 && *(char*)key.dptr == 0)
-        return atoln(key.dptr + 1, key.dsize - 1);
-    return lookup_next_objnum();
+    while (++objnums_cursor < objnums_size) {
+        if (objnums[objnums_cursor].size)
+            return objnums_cursor;
+    }
+    return NOT_AN_IDENT;
 }
 
 Int lookup_retrieve_name(Ident name, cObjnum *objnum)
@@ -246,7 +295,7 @@ Int lookup_store_name(Ident name, cObjnum objnum)
     if (name_cache[i].name == name) {
         if (name_cache[i].objnum != objnum) {
             name_cache[i].objnum = objnum;
-            name_cache[i].dirty = 1;
+            mark_name_dirty(i);
         }
         UNLOCK_LOOKUP("lookup_store_name");
         return 1;
@@ -262,8 +311,8 @@ Int lookup_store_name(Ident name, cObjnum objnum)
     /* Make a new cache entry. */
     name_cache[i].name = ident_dup(name);
     name_cache[i].objnum = objnum;
-    name_cache[i].dirty = 1;
     name_cache[i].on_disk = 0;
+    mark_name_dirty(i);
 
     UNLOCK_LOOKUP("lookup_store_name");
     return 1;
@@ -293,6 +342,7 @@ Int lookup_remove_name(Ident name)
         UNLOCK_LOOKUP("lookup_remove_name");
         return 0;
     }
+    dbm_changed = 1;
 
     UNLOCK_LOOKUP("lookup_remove_name");
     return 1;
@@ -312,27 +362,6 @@ static datum objnum_key(cObjnum objnum, Number_buf nbuf)
     return key;
 }
 
-static datum offset_size_value(off_t offset, Int size, Number_buf nbuf)
-{
-    char *s;
-    Number_buf tmp_buf;
-    datum value;
-
-    /* Set up a value for the offset and size. */
-#if _FILE_OFFSET_BITS == 32
-    s = long_to_ascii(offset, tmp_buf);
-#else
-    s = long_long_to_ascii(offset, tmp_buf);
-#endif
-    strcpy(nbuf, s);
-    strcat(nbuf, ";");
-    s = long_to_ascii(size, tmp_buf);
-    strcat(nbuf, s);
-    value.dptr = nbuf;
-    value.dsize = strlen(nbuf) + 1;
-    return value;
-}
-
 static void parse_offset_size_value(datum value, off_t *offset, Int *size)
 {
     char *p;
@@ -369,17 +398,20 @@ static datum objnum_value(cObjnum objnum, Number_buf nbuf)
 
 static void sync_name_cache(void)
 {
-    Int i;
+    Int i, n;
 
     write_err ("Syncing lookup name cache...");
 
-    for (i = 0; i < NAME_CACHE_SIZE; i++) {
+    for (n = 0; n < dirty_names_count; n++) {
+        i = dirty_names[n];
+        name_cache[i].listed = 0;
         if (name_cache[i].name != NOT_AN_IDENT && name_cache[i].dirty) {
             store_name(name_cache[i].name, name_cache[i].objnum);
             name_cache[i].dirty = 0;
             name_cache[i].on_disk = 1;
         }
     }
+    dirty_names_count = 0;
 }
 
 static Int store_name(Ident name, cObjnum objnum)
@@ -395,6 +427,7 @@ static Int store_name(Ident name, cObjnum objnum)
         write_err("ERROR: Failed to store key %s.", name);
         return 0;
     }
+    dbm_changed = 1;
 
     return 1;
 }
@@ -413,3 +446,206 @@ static Int get_name(Ident name, cObjnum *objnum)
     return 1;
 }
 
+
+/*
+// -------------------------------------------------------------------------
+// The objnum array.  On disk it is the same array, entry N at byte
+// N * sizeof(_offset_size), in the native layout; the binary database is
+// tied to the system that wrote it anyway.  Stores only mark a range of
+// entries dirty, lookup_sync() writes that range out.
+*/
+
+static void open_objnums(char *name, Int cnew)
+{
+    char        buf[BUF];
+    struct stat statbuf;
+    Int         imported = 0;
+    Long        got, want, n;
+
+    sprintf(buf, "%s.objnum", name);
+    objnums_size = 0;
+    dirty_low = dirty_high = 0;
+
+    /* an index written before the objnum file existed */
+    if (!cnew && stat(buf, &statbuf) == F_FAILURE) {
+        import_objnums(buf);
+        imported = 1;
+    }
+
+    objnum_fd = open(buf, O_RDWR | O_CREAT | O_BINARY | (cnew ? O_TRUNC : 0),
+                     READ_WRITE);
+    if (objnum_fd == F_FAILURE)
+        fail_to_start("Cannot open objnum index file.");
+
+    if (cnew || imported) {
+        grow_objnums(0);
+        return;
+    }
+
+    if (fstat(objnum_fd, &statbuf) == F_FAILURE)
+        fail_to_start("Cannot stat objnum index file.");
+
+    /* an empty index with objects to go with it was never written out */
+    if (!statbuf.st_size) {
+        sprintf(buf, "%s/objects", c_dir_binary);
+        if (stat(buf, &statbuf) != F_FAILURE && statbuf.st_size)
+            fail_to_start("Objnum index file is empty but the objects file is not.");
+        grow_objnums(0);
+        return;
+    }
+
+    want = statbuf.st_size / sizeof(_offset_size);
+    grow_objnums(want ? want - 1 : 0);
+    want *= sizeof(_offset_size);
+    for (got = 0; got < want; got += n) {
+        n = read(objnum_fd, (char *) objnums + got, want - got);
+        if (n < 0 && errno == EINTR)
+            n = 0;
+        else if (n <= 0)
+            fail_to_start("Cannot read objnum index file.");
+    }
+}
+
+/*
+// Move the objnum keys of an older dbm index into the array.  The array
+// is written to a temporary file, synced and renamed into place before
+// any key is deleted, so that a crash at any point leaves one complete
+// copy of the index behind.
+*/
+static void import_objnums(char *path)
+{
+    char       tmp[BUF];
+    datum      key, value;
+    cObjnum    objnum, top;
+    Number_buf nbuf;
+
+    grow_objnums(0);
+    top = -1;
+    for (key = dbm_firstkey(dbp); key.dptr; key = dbm_nextkey(dbp)) {
+        if (key.dsize <= 1 || *(char *) key.dptr != 0)
+            continue;
+        objnum = atoln(key.dptr + 1, key.dsize - 1);
+        value = dbm_fetch(dbp, key);
+        if (!value.dptr)
+            continue;
+        if (objnum >= objnums_size)
+            grow_objnums(objnum);
+        parse_offset_size_value(value, &objnums[objnum].offset,
+                                &objnums[objnum].size);
+        if (objnum > top)
+            top = objnum;
+    }
+
+    sprintf(tmp, "%s.new", path);
+    if (!write_objnums(tmp, (top + 1) * sizeof(_offset_size)) ||
+        rename(tmp, path) == F_FAILURE)
+        fail_to_start("Cannot write objnum index file.");
+
+    /* the keys can't be deleted while walking them */
+    for (objnum = 0; objnum <= top; objnum++) {
+        if (objnums[objnum].size)
+            dbm_delete(dbp, objnum_key(objnum, nbuf));
+    }
+    dbm_changed = 1;
+}
+
+/* Write the first end bytes of the array to a new file at path and sync
+   it.  Returns 0 if that fails. */
+static Int write_objnums(char *path, Long end)
+{
+    Long pos, n;
+    int  fd;
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, READ_WRITE);
+    if (fd == F_FAILURE)
+        return 0;
+    for (pos = 0; pos < end; pos += n) {
+        n = write(fd, (char *) objnums + pos, end - pos);
+        if (n < 0 && errno == EINTR) {
+            n = 0;
+        } else if (n <= 0) {
+            close(fd);
+            return 0;
+        }
+    }
+    if (fsync(fd) == F_FAILURE) {
+        close(fd);
+        return 0;
+    }
+    return close(fd) != F_FAILURE;
+}
+
+/*
+// For replacing the whole index at once, as simble_reblock() does: write
+// all of it to index.objnum.new, and later rename that over index.objnum.
+// Both return 0 on failure.
+*/
+Int lookup_stage_objnums(void)
+{
+    char    buf[BUF];
+    cObjnum top;
+
+    sprintf(buf, "%s/index.objnum.new", c_dir_binary);
+    for (top = objnums_size - 1; top >= 0 && !objnums[top].size; top--);
+    return write_objnums(buf, (top + 1) * sizeof(_offset_size));
+}
+
+Int lookup_commit_objnums(void)
+{
+    char buf[BUF],
+         new[BUF + 4];
+
+    sprintf(buf, "%s/index.objnum", c_dir_binary);
+    sprintf(new, "%s.new", buf);
+    if (rename(new, buf) == F_FAILURE)
+        return 0;
+
+    LOCK_LOOKUP("lookup_commit_objnums");
+    close(objnum_fd);
+    objnum_fd = open(buf, O_RDWR | O_BINARY, READ_WRITE);
+    dirty_low = dirty_high = 0;
+    UNLOCK_LOOKUP("lookup_commit_objnums");
+
+    return objnum_fd != F_FAILURE;
+}
+
+static void grow_objnums(cObjnum objnum)
+{
+    cObjnum size = objnums_size ? objnums_size : 1024;
+
+    while (size <= objnum)
+        size *= 2;
+    if (size == objnums_size)
+        return;
+
+    objnums = EREALLOC(objnums, _offset_size, size);
+    memset(objnums + objnums_size, 0,
+           (size - objnums_size) * sizeof(_offset_size));
+    objnums_size = size;
+}
+
+static void sync_objnums(void)
+{
+    Long   pos, end;
+    Long   n;
+
+    if (dirty_low >= dirty_high)
+        return;
+
+    pos = dirty_low * sizeof(_offset_size);
+    end = dirty_high * sizeof(_offset_size);
+    if (lseek(objnum_fd, pos, SEEK_SET) == F_FAILURE)
+        panic("Cannot seek in objnum index file: %s", strerror(errno));
+    while (pos < end) {
+        n = write(objnum_fd, (char *) objnums + pos, end - pos);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            panic("Cannot write objnum index file: %s", strerror(errno));
+        pos += n;
+    }
+    if (fsync(objnum_fd) == F_FAILURE)
+        write_err("ERROR: Unable to sync objnum index file: %s", strerror(errno));
+
+    dirty_low = dirty_high = 0;
+}
@@ -144,7 +144,27 @@ NATIVE_METHOD(version) {
 
 /*
 // -----------------------------------------------------------------
+// The lookup may be handed to a resolver thread, in which case the task
+// is suspended here and handle_dns_replies() resumes it with the answer.
 */
+#define DNS_LOOKUP(_type_, _query_, _buf_) do { \
+        Int    _result_; \
+        Ident  _error_; \
+        cStr * _str_; \
+        \
+        _result_ = dns_lookup(_type_, _query_, _buf_); \
+        if (_result_ == DNS_PENDING) { \
+            CLEAN_STACK(); \
+            dns_suspend(); \
+            RETURN_TRUE; \
+        } else if (_result_ != DNS_NOERROR) { \
+            _str_ = dns_failure(_type_, _result_, _query_, &_error_); \
+            cthrow(_error_, "%S", _str_); \
+            string_discard(_str_); \
+            RETURN_FALSE; \
+        } \
+    } while (0)
+
 NATIVE_METHOD(hostname) {
     cStr * name;
     char   buf[DNS_MAXLEN+1];
@@ -154,14 +174,7 @@ NATIVE_METHOD(hostname) {
     if (!argc) {
         name = string_dup(str_hostname);
     } else {
-        switch (lookup_name_by_ip(string_chars(STR1), buf)) {
-            case DNS_INVADDR:
-                THROW((address_id, "Invalid IP Address: %S", STR1));
-            case DNS_NORESOLV:
-                THROW((failed_id, "No name for IP Address %S", STR1));
-            case DNS_OVERFLOW:
-                THROW((range_id, "DNS Response overflows DNS_MAXLEN!"));
-        }
+        DNS_LOOKUP(DNS_BY_IP, string_chars(STR1), buf);
         name = string_from_chars(buf, strlen(buf));
     }
 
@@ -183,12 +196,7 @@ NATIVE_METHOD(ip) {
     else
         p = string_chars(STR1);
 
-    switch (lookup_ip_by_name(p, buf)) {
-        case DNS_NORESOLV:
-            THROW((failed_id, "Address %s does not resolv", p));
-        case DNS_OVERFLOW:
-            THROW((range_id, "DNS Response overflows DNS_MAXLEN!"));
-    }
+    DNS_LOOKUP(DNS_BY_NAME, p, buf);
     sip = string_from_chars(buf, strlen(buf));
 
     CLEAN_RETURN_STRING(sip);
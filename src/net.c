@@ -18,6 +18,9 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #endif
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
 #include <ctype.h>
 #include <fcntl.h>
 #include "net.h"
@@ -26,6 +29,26 @@
 static SOCKET grab_port(Int port, char * addr, int socktype);
 static Long translate_connect_error(Int error);
 
+/* I/O event backend, see io_event_wait() */
+#define IO_EVENT_READ  1
+#define IO_EVENT_WRITE 2
+
+typedef struct io_backend_s {
+    void (*uninit)(void);
+    void (*add)(SOCKET fd, io_watch_t *watch, Int events);
+    void (*modify)(SOCKET fd, io_watch_t *watch, Int events);
+    void (*remove)(SOCKET fd, io_watch_t *watch);
+    Int  (*wait)(Int sec, Conn *connections, server_t *servers,
+                 pending_t *pendings, Conn **ready);
+} io_backend_t;
+
+static io_backend_t select_backend;
+#ifdef USE_EPOLL
+static io_backend_t epoll_backend;
+static Int epoll_init(void);
+#endif
+static io_backend_t * io_backend;
+
 static struct sockaddr_in sockin;        /* An internet address. */
 static socklen_t addr_size = sizeof(sockin);        /* Size of sockin. */
 
@@ -38,12 +61,22 @@ void init_net(void) {
     WSAStartup(0x0101, &wsa);
 #endif
     socket_buffer = buffer_new(BIGBUF);
+
+    io_backend = &select_backend;
+#ifdef USE_EPOLL
+    if (epoll_init() == F_SUCCESS)
+        io_backend = &epoll_backend;
+    else
+        fprintf(stderr, "epoll unavailable (%s), using select()\n",
+                strerror(GETERR()));
+#endif
 }
 
 void uninit_net(void) {
 #ifdef __Win32__
     WSACleanup();
 #endif
+    io_backend->uninit();
     buffer_discard(socket_buffer);
 }
 
@@ -287,19 +320,157 @@ SOCKET get_udp_socket(Int port, char * addr) {
     return sock;
 }
 
-/* Wait for I/O events.  sec is the number of seconds we can wait before
- * returning, or -1 if we can wait forever.  Returns nonzero if an I/O event
- * happened. */
-Int io_event_wait(Int sec, Conn *connections, server_t *servers,
-                  pending_t *pendings)
+/*
+// -----------------------------------------------------------------------
+// I/O event backends.  A backend keeps track of which descriptors we are
+// interested in and waits for something to happen on them.  When it
+// returns, connections which can be read from or written to have their
+// flags set and are chained onto the ready list, new clients have been
+// accepted on the server sockets and pending connections which completed
+// are marked finished.  Anything readable on a wakeup descriptor just ends
+// the wait early.
+//
+// select() is always available.  When USE_EPOLL is defined and the kernel
+// supports it, epoll is used instead; its registrations persist between
+// calls, so the cost of a wait depends on how many descriptors are active
+// rather than how many are open.
+*/
+
+static Int conn_events(Conn *conn) {
+    Int events = 0;
+
+    if (!conn->flags.dead && !conn->flags.throttled)
+        events |= IO_EVENT_READ;
+    if (conn->write_len)
+        events |= IO_EVENT_WRITE;
+
+    return events;
+}
+
+void io_event_watch(SOCKET fd, io_watch_t *watch, Int type, void *owner) {
+    Int events;
+
+    switch (type) {
+      case IO_WATCH_CONN:
+        events = conn_events((Conn *) owner);
+        break;
+      case IO_WATCH_SERVER:
+      case IO_WATCH_WAKEUP:
+        events = IO_EVENT_READ;
+        break;
+      default:
+        events = IO_EVENT_WRITE;
+        break;
+    }
+
+    watch->type = type;
+    watch->owner = owner;
+    io_backend->add(fd, watch, events);
+    watch->events = events;
+}
+
+void io_event_unwatch(SOCKET fd, io_watch_t *watch) {
+    if (!watch->type)
+        return;
+    io_backend->remove(fd, watch);
+    watch->type = 0;
+    watch->events = 0;
+}
+
+/* Bring the backend up to date after a connection's output buffer or
+ * dead flag changed. */
+void io_event_update_conn(Conn *conn) {
+    Int events;
+
+    if (!conn->watch.type)
+        return;
+
+    events = conn_events(conn);
+    if (events != conn->watch.events) {
+        io_backend->modify(conn->fd, &conn->watch, events);
+        conn->watch.events = events;
+    }
+}
+
+static void accept_client(server_t *serv) {
+    Int flags;
+#ifdef __Win32__
+    Int result;
+#endif
+
+    serv->client_socket = accept(serv->server_socket,
+                                 (struct sockaddr *) &sockin, &addr_size);
+    if (serv->client_socket == SOCKET_ERROR)
+        return;
+#ifdef __Win32__
+    result = 1;
+    ioctlsocket(serv->client_socket, FIONBIO, &result);
+#else
+    flags = fcntl(serv->client_socket, F_GETFL);
+    flags |= O_NONBLOCK;
+    fcntl(serv->client_socket, F_SETFL, flags);
+#endif
+
+    /* Get address and local port of client. */
+    strcpy(serv->client_addr, inet_ntoa(sockin.sin_addr));
+    serv->client_port = ntohs(sockin.sin_port);
+
+    /* Set the CLOEXEC flag on socket so that it will be closed for a
+     * execute() operation. */
+#ifdef FD_CLOEXEC
+    flags = fcntl(serv->client_socket, F_GETFD);
+    flags |= FD_CLOEXEC;
+    fcntl(serv->client_socket, F_SETFD, flags);
+#endif
+}
+
+static void finish_pending(pending_t *pend) {
+    Int result, error;
+    socklen_t dummy = sizeof(int);
+
+    result = getpeername(pend->fd, (struct sockaddr *) &sockin, &addr_size);
+    if (result == SOCKET_ERROR) {
+        getsockopt(pend->fd, SOL_SOCKET, SO_ERROR, (char *) &error, &dummy);
+        pend->error = translate_connect_error(error);
+    } else {
+        pend->error = NOT_AN_IDENT;
+    }
+    pend->finished = 1;
+
+    /* if it connected, it will be watched again as a Conn */
+    io_event_unwatch(pend->fd, &pend->watch);
+}
+
+/*
+// -----------------------------------------------------------------------
+// select() backend.  The descriptor sets are built from scratch on every
+// call, the only thing it remembers is the wakeup descriptor.
+*/
+
+static SOCKET select_wakeup = SOCKET_ERROR;
+
+static void select_uninit(void) {
+}
+
+static void select_watch(SOCKET fd, io_watch_t *watch, Int events) {
+    if (watch->type == IO_WATCH_WAKEUP)
+        select_wakeup = fd;
+}
+
+static void select_remove(SOCKET fd, io_watch_t *watch) {
+    if (watch->type == IO_WATCH_WAKEUP)
+        select_wakeup = SOCKET_ERROR;
+}
+
+static Int select_wait(Int sec, Conn *connections, server_t *servers,
+                       pending_t *pendings, Conn **ready)
 {
     struct timeval tv, *tvp;
     Conn *conn;
     server_t *serv;
     pending_t *pend;
     fd_set read_fds, write_fds, except_fds;
-    Int flags, nfds, count, result, error;
-    socklen_t dummy = sizeof(int);
+    Int nfds, count;
 
     /* Set time structure according to sec. */
     if (sec == -1) {
@@ -321,11 +492,11 @@ Int io_event_wait(Int sec, Conn *connections, server_t *servers,
     /* Listen for new data on connections, and also check for ability to write
      * to them if we have data to write. */
     for (conn = connections; conn; conn = conn->next) {
-        if (!conn->flags.dead) {
+        if (!conn->flags.dead && !conn->flags.throttled) {
             FD_SET(conn->fd, &except_fds);
             FD_SET(conn->fd, &read_fds);
         }
-        if (conn->write_buf->len)
+        if (conn->write_len)
             FD_SET(conn->fd, &write_fds);
         if (conn->fd >= nfds)
             nfds = conn->fd + 1;
@@ -340,16 +511,19 @@ Int io_event_wait(Int sec, Conn *connections, server_t *servers,
 
     /* Check pending connections for ability to write. */
     for (pend = pendings; pend; pend = pend->next) {
-        if (pend->error != NOT_AN_IDENT) {
-            /* The connect has already failed; just set the finished bit. */
-            pend->finished = 1;
-        } else {
+        if (!pend->finished) {
             FD_SET(pend->fd, &write_fds);
             if (pend->fd >= nfds)
                 nfds = pend->fd + 1;
         }
     }
 
+    if (select_wakeup != SOCKET_ERROR) {
+        FD_SET(select_wakeup, &read_fds);
+        if (select_wakeup >= nfds)
+            nfds = select_wakeup + 1;
+    }
+
 #ifdef __Win32__
     /* Winsock 2.0 will return EINVAL (invalid argument) if there are no
        sockets checked in any of the FDSETs.  At least one server must be
@@ -386,56 +560,186 @@ Int io_event_wait(Int sec, Conn *connections, server_t *servers,
             conn->flags.readable = 1;
         if (FD_ISSET(conn->fd, &write_fds))
             conn->flags.writable = 1;
+        if (conn->flags.readable || conn->flags.writable) {
+            *ready = conn;
+            ready = &conn->next_ready;
+        }
     }
+    *ready = NULL;
 
     /* Check if any server sockets have new connections. */
     for (serv = servers; serv; serv = serv->next) {
-        if (FD_ISSET(serv->server_socket, &read_fds)) {
-            serv->client_socket = accept(serv->server_socket,
-                                 (struct sockaddr *) &sockin, &addr_size);
-            if (serv->client_socket == SOCKET_ERROR)
-                continue;
-#ifdef __Win32__
-            result = 1;
-            ioctlsocket(serv->client_socket, FIONBIO, &result);
+        if (FD_ISSET(serv->server_socket, &read_fds))
+            accept_client(serv);
+    }
+
+    /* Check if any pending connections have succeeded or failed. */
+    for (pend = pendings; pend; pend = pend->next) {
+        if (!pend->finished && FD_ISSET(pend->fd, &write_fds))
+            finish_pending(pend);
+    }
+
+    /* Return nonzero, indicating that at least one I/O event occurred. */
+    return 1;
+}
+
+static io_backend_t select_backend = {
+    select_uninit,
+    select_watch,
+    select_watch,
+    select_remove,
+    select_wait
+};
+
+#ifdef USE_EPOLL
+/*
+// -----------------------------------------------------------------------
+// epoll backend.  Descriptors stay registered until they are closed, and
+// write interest is only registered while a connection has output queued,
+// so an idle connection costs nothing per call.  Registrations are level
+// triggered, leaving the read/write paths exactly as they are for select().
+*/
+
+#define EPOLL_MAX_EVENTS 256
+
+static int epoll_fd = -1;
+static struct epoll_event epoll_events[EPOLL_MAX_EVENTS];
+
+static Int epoll_init(void) {
+#ifdef EPOLL_CLOEXEC
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
 #else
-            flags = fcntl(serv->client_socket, F_GETFL);
-            flags |= O_NONBLOCK;
-            fcntl(serv->client_socket, F_SETFL, flags);
+    epoll_fd = epoll_create(EPOLL_MAX_EVENTS);
 #endif
+    return (epoll_fd == F_FAILURE) ? F_FAILURE : F_SUCCESS;
+}
 
-            /* Get address and local port of client. */
-            strcpy(serv->client_addr, inet_ntoa(sockin.sin_addr));
-            serv->client_port = ntohs(sockin.sin_port);
+static void epoll_uninit(void) {
+    close(epoll_fd);
+    epoll_fd = -1;
+}
 
-            /* Set the CLOEXEC flag on socket so that it will be closed for a
-             * execute() operation. */
-#ifdef FD_CLOEXEC
-            flags = fcntl(serv->client_socket, F_GETFD);
-            flags |= FD_CLOEXEC;
-            fcntl(serv->client_socket, F_SETFD, flags);
-#endif
+static void epoll_control(int op, SOCKET fd, io_watch_t *watch, Int events) {
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    if (events & IO_EVENT_READ)
+        ev.events |= EPOLLIN | EPOLLPRI;
+    if (events & IO_EVENT_WRITE)
+        ev.events |= EPOLLOUT;
+    ev.data.ptr = watch;
+
+    if (epoll_ctl(epoll_fd, op, fd, &ev) == F_FAILURE)
+        write_err("epoll_ctl(%d, %d): %s", op, fd, strerror(GETERR()));
+}
+
+static void epoll_add(SOCKET fd, io_watch_t *watch, Int events) {
+    epoll_control(EPOLL_CTL_ADD, fd, watch, events);
+}
+
+static void epoll_modify(SOCKET fd, io_watch_t *watch, Int events) {
+    epoll_control(EPOLL_CTL_MOD, fd, watch, events);
+}
+
+static void epoll_remove(SOCKET fd, io_watch_t *watch) {
+    epoll_control(EPOLL_CTL_DEL, fd, watch, 0);
+}
+
+static Int epoll_wait_events(Int sec, Conn *connections, server_t *servers,
+                             pending_t *pendings, Conn **ready)
+{
+    Conn *conn;
+    pending_t *pend;
+    io_watch_t *watch;
+    uInt events;
+    Int count, i, timeout;
+
+    if (sec == -1) {
+        timeout = -1;
+        /* this is a rather odd thing to happen for me */
+        write_err("epoll: forever wait");
+    } else {
+        timeout = sec * 1000;
+    }
+
+    count = epoll_wait(epoll_fd, epoll_events, EPOLL_MAX_EVENTS, timeout);
+
+    /* Same as select(): ERR_INTR is not an error, just no events. */
+    if (count == F_FAILURE) {
+        if (GETERR() != ERR_INTR)
+            panic("epoll_wait() failed");
+        *ready = NULL;
+        return 0;
+    }
+
+    for (i = 0; i < count; i++) {
+        watch = (io_watch_t *) epoll_events[i].data.ptr;
+        events = epoll_events[i].events;
+
+        switch (watch->type) {
+          case IO_WATCH_CONN:
+            conn = (Conn *) watch->owner;
+            if (events & EPOLLPRI) {
+                conn->flags.dead = 1;
+                fprintf(stderr, "An exception occurred during epoll_wait()\n");
+            }
+            if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                /* select() would not have been watching it for input */
+                if (conn->flags.dead)
+                    io_event_update_conn(conn);
+                else
+                    conn->flags.readable = 1;
+            }
+            if ((events & (EPOLLOUT | EPOLLERR)) &&
+                (watch->events & IO_EVENT_WRITE))
+                conn->flags.writable = 1;
+            if (conn->flags.readable || conn->flags.writable) {
+                *ready = conn;
+                ready = &conn->next_ready;
+            }
+            break;
+          case IO_WATCH_SERVER:
+            accept_client((server_t *) watch->owner);
+            break;
+          case IO_WATCH_PENDING:
+            pend = (pending_t *) watch->owner;
+            if (!pend->finished)
+                finish_pending(pend);
+            break;
+          case IO_WATCH_WAKEUP:
+            break;
         }
     }
+    *ready = NULL;
 
-    /* Check if any pending connections have succeeded or failed. */
+    return count ? 1 : 0;
+}
+
+static io_backend_t epoll_backend = {
+    epoll_uninit,
+    epoll_add,
+    epoll_modify,
+    epoll_remove,
+    epoll_wait_events
+};
+#endif
+
+/* Wait for I/O events.  sec is the number of seconds we can wait before
+ * returning, or -1 if we can wait forever.  Returns nonzero if an I/O event
+ * happened.  Connections with something to do are chained through
+ * next_ready onto *ready. */
+Int io_event_wait(Int sec, Conn *connections, server_t *servers,
+                  pending_t *pendings, Conn **ready)
+{
+    pending_t *pend;
+
+    /* The connect has already failed; just set the finished bit. */
     for (pend = pendings; pend; pend = pend->next) {
-        if (FD_ISSET(pend->fd, &write_fds)) {
-            result = getpeername(pend->fd, (struct sockaddr *) &sockin,
-                                 &addr_size);
-            if (result == SOCKET_ERROR) {
-                getsockopt(pend->fd, SOL_SOCKET, SO_ERROR, (char *) &error,
-                           &dummy);
-                pend->error = translate_connect_error(error);
-            } else {
-                pend->error = NOT_AN_IDENT;
-            }
+        if (pend->error != NOT_AN_IDENT)
             pend->finished = 1;
-        }
     }
 
-    /* Return nonzero, indicating that at least one I/O event occurred. */
-    return 1;
+    return io_backend->wait(sec, connections, servers, pendings, ready);
 }
 
 Long non_blocking_connect(char *addr, Int port, Int *socket_return)
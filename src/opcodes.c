@@ -118,6 +118,15 @@ static Op_info op_info[] = {
     { SCATTER_START,    "SCATTER_START",   op_scatter_start },
     { SCATTER_END,      "SCATTER_END",     0},
 
+    /* Superinstructions (operators.c), see fuse_opcodes() in codegen.c.
+     * Each takes the same arguments as the opcode it replaces. */
+    { SET_LOCAL_POP,    "SET_LOCAL_POP",   op_set_local_pop, VAR },
+    { LOCAL_ARITH,      "LOCAL_ARITH",     op_local_arith, VAR },
+    { LOCAL_CMP_JUMP,   "LOCAL_CMP_JUMP",  op_local_cmp_jump, VAR },
+    { OBJ_VAR_ARGS,     "OBJ_VAR_ARGS",    op_obj_var_args, IDENT },
+    { END_FOR,          "END_FOR",         op_end_for, JUMP },
+    { SWITCH_TABLE,     "SWITCH_TABLE",    op_switch_table, JUMP },
+
     /* Object variable functions, MUST be in alpha order */
     FDEF(F_ABS,                   "abs",                   abs),
     FDEF(F_ACOS,                  "acos",                  acos),
@@ -352,3 +361,17 @@ Int find_function(char *name) {
         return -1;
 }
 
+/* Returns the opcode a superinstruction was fused from, see fuse_opcodes()
+ * in codegen.c. */
+Long unfused_opcode(Long opcode) {
+    switch (opcode) {
+      case SET_LOCAL_POP:  return SET_LOCAL;
+      case LOCAL_ARITH:    return GET_LOCAL;
+      case LOCAL_CMP_JUMP: return GET_LOCAL;
+      case OBJ_VAR_ARGS:   return GET_OBJ_VAR;
+      case END_FOR:        return END;
+      case SWITCH_TABLE:   return SWITCH;
+      default:             return opcode;
+    }
+}
+
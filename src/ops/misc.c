@@ -46,7 +46,7 @@ COLDC_FUNC(anticipate_assignment) {
     while ((opcode = caller_frame->opcodes[pc]) == CRITICAL_END)
         pc++;
 
-    switch (opcode) {
+    switch (unfused_opcode(opcode)) {
       case SET_LOCAL:
         /* Zero out local variable value. */
         dp = &stack[caller_frame->var_start +
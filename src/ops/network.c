@@ -207,6 +207,12 @@ COLDC_FUNC(cwritef) {
     buf = buffer_new(block);
 
     while (!feof(fp)) {
+        /* ctell() queues the buffer itself, get a new one if it did */
+        if (buf->refs > 1) {
+            buffer_discard(buf);
+            buf = buffer_new(block);
+        }
+
         r = fread(buf->s, sizeof(unsigned char), block, fp);
         if (r != block) {
             if (!feof(fp)) {
@@ -219,8 +225,10 @@ COLDC_FUNC(cwritef) {
                 buf->len = r;
                 ctell(cur_frame->object, buf);
             }
-        } else
+        } else {
+            buf->len = r;
             ctell(cur_frame->object, buf);
+        }
     }
 
     /* Discard the buffer and close the file. */
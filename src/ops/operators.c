@@ -25,11 +25,13 @@
 COLDC_OP(comment) {
     /* Do nothing, just increment the program counter past the comment. */
     cur_frame->pc++;
+#ifndef USE_THREADED_DISPATCH
     /* actually, increment the number of ticks left too, since comments
        really don't do anything */
     cur_frame->ticks++;
     /* decrement system tick */
     tick--;
+#endif
 }
 
 COLDC_OP(pop) {
@@ -2404,3 +2406,241 @@ COLDC_OP(bwshl) {
     }
 }
 
+
+/*
+// -----------------------------------------------------------------
+//
+// Superinstructions.  fuse_opcodes() in codegen.c replaces the first
+// opcode of a common sequence with one of these, but leaves the rest of
+// the sequence in place: anything jumping into the middle of it still
+// runs the original opcodes, and when the fast path does not apply the
+// superinstruction just does what the opcode it replaced would have.
+// Each one is charged the ticks of the opcodes it runs past, so a task
+// gets no further on its ticks than it did before.
+//
+*/
+
+/* Read the ZERO, ONE or INTEGER at pc, returning the pc after it. */
+static Int fused_constant(Long *opcodes, Int pc, cNum *val) {
+    switch (opcodes[pc]) {
+      case ZERO:
+        *val = 0;
+        return pc + 1;
+      case ONE:
+        *val = 1;
+        return pc + 1;
+      default:
+        *val = opcodes[pc + 1];
+        return pc + 2;
+    }
+}
+
+/* SET_LOCAL, POP: move the value into the variable instead of copying it
+ * and then discarding the original. */
+COLDC_OP(set_local_pop) {
+    cData *var;
+
+    var = &stack[cur_frame->var_start + cur_frame->opcodes[cur_frame->pc]];
+    data_discard(var);
+    *var = stack[--stack_pos];
+    cur_frame->pc += 2;
+    charge_ticks(1);
+}
+
+/* GET_LOCAL, ZERO/ONE/INTEGER, +/-: integer arithmetic on a local. */
+COLDC_OP(local_arith) {
+    Long  * opcodes = cur_frame->opcodes;
+    cData * var = &stack[cur_frame->var_start + opcodes[cur_frame->pc]];
+    Int     pc;
+    cNum    val;
+
+    if (var->type != INTEGER) {
+        op_get_local();
+        return;
+    }
+
+    pc = fused_constant(opcodes, cur_frame->pc + 1, &val);
+    if (opcodes[pc] == '+')
+        val = var->u.val + val;
+    else
+        val = var->u.val - val;
+    cur_frame->pc = pc + 1;
+    charge_ticks(2);
+    push_int(val);
+}
+
+/* GET_LOCAL, GET_LOCAL/ZERO/ONE/INTEGER, comparison, IF/WHILE: compare
+ * two integers (or test any two values of the same type for equality)
+ * and branch, without pushing anything. */
+COLDC_OP(local_cmp_jump) {
+    Long  * opcodes = cur_frame->opcodes;
+    cData * d1 = &stack[cur_frame->var_start + opcodes[cur_frame->pc]];
+    cData * d2, c;
+    Int     pc = cur_frame->pc + 1, cmp, op;
+
+    if (opcodes[pc] == GET_LOCAL) {
+        d2 = &stack[cur_frame->var_start + opcodes[pc + 1]];
+        pc += 2;
+    } else {
+        c.type = INTEGER;
+        pc = fused_constant(opcodes, pc, &c.u.val);
+        d2 = &c;
+    }
+    op = opcodes[pc++];
+
+    if (d1->type == INTEGER && d2->type == INTEGER) {
+        cmp = (d1->u.val > d2->u.val) - (d1->u.val < d2->u.val);
+    } else if (d1->type == d2->type && (op == EQ || op == NE)) {
+        cmp = data_cmp(d1, d2);
+    } else {
+        op_get_local();
+        return;
+    }
+
+    switch (op) {
+      case EQ:  cmp = (cmp == 0); break;
+      case NE:  cmp = (cmp != 0); break;
+      case '>': cmp = (cmp > 0);  break;
+      case GE:  cmp = (cmp >= 0); break;
+      case '<': cmp = (cmp < 0);  break;
+      default:  cmp = (cmp <= 0); break;
+    }
+
+    /* pc is at the IF, IF_ELSE, CONDITIONAL or WHILE; see op_if() and
+     * op_while(). */
+    if (!cmp)
+        cur_frame->pc = opcodes[pc + 1];
+    else if (opcodes[pc] == WHILE)
+        cur_frame->pc = pc + 3;
+    else
+        cur_frame->pc = pc + 2;
+    charge_ticks(3);
+}
+
+/* GET_OBJ_VAR, START_ARGS: the receiver of a message to an object
+ * variable. */
+COLDC_OP(obj_var_args) {
+    Frame * frame = cur_frame;
+    Int     pc = cur_frame->pc + 1;
+
+    cur_frame->last_opcode = GET_OBJ_VAR;
+    op_get_obj_var();
+    if (cur_frame != frame || cur_frame->pc != pc)
+        return;
+    cur_frame->last_opcode = START_ARGS;
+    cur_frame->pc++;
+    charge_ticks(1);
+    op_start_args();
+}
+
+/* END of a FOR_LIST or FOR_RANGE loop: run the loop opcode directly
+ * rather than jumping back to dispatch it. */
+COLDC_OP(end_for) {
+    Int loop = cur_frame->opcodes[cur_frame->pc];
+
+    cur_frame->pc = loop + 1;
+    cur_frame->last_opcode = cur_frame->opcodes[loop];
+    charge_ticks(1);
+    if (cur_frame->last_opcode == FOR_LIST)
+        op_for_list();
+    else
+        op_for_range();
+}
+
+/*
+// Walk the cases of the SWITCH at pc.  If every case value is an integer,
+// string or symbol constant, returns how many there are and, if table is
+// not NULL, maps each value to the pc of its case body in table->cases
+// (the first case wins, as it would when they are compared in turn).
+// Returns -1 if there is any other kind of case.
+*/
+Int switch_table_cases(Method *method, Int pc, SwitchTable *table) {
+    Long  * opcodes = method->opcodes;
+    Int     count = 0, next;
+    cData   val, dest;
+
+    pc += 2;
+    dest.type = INTEGER;
+    while (opcodes[pc] != DEFAULT) {
+        switch (opcodes[pc]) {
+          case ZERO:
+          case ONE:
+          case INTEGER:
+            val.type = INTEGER;
+            next = fused_constant(opcodes, pc, &val.u.val);
+            break;
+          case STRING:
+            val.type = STRING;
+            if (table)
+                val.u.str = object_get_string(method->object, opcodes[pc + 1]);
+            next = pc + 2;
+            break;
+          case SYMBOL:
+            val.type = SYMBOL;
+            if (table)
+                val.u.symbol = object_get_ident(method->object,
+                                                opcodes[pc + 1]);
+            next = pc + 2;
+            break;
+          default:
+            return -1;
+        }
+
+        /* CASE_VALUE jumps to the body, LAST_CASE_VALUE falls into it and
+         * otherwise jumps to the next case. */
+        if (opcodes[next] == CASE_VALUE) {
+            dest.u.val = opcodes[next + 1];
+            pc = next + 2;
+        } else if (opcodes[next] == LAST_CASE_VALUE) {
+            dest.u.val = next + 2;
+            pc = opcodes[next + 1];
+        } else {
+            return -1;
+        }
+
+        if (table && !dict_contains(table->cases, &val))
+            table->cases = dict_add(table->cases, &val, &dest);
+        count++;
+    }
+
+    if (table)
+        table->default_pc = pc;
+
+    return count;
+}
+
+/* SWITCH whose cases are all constants: look the value up in the method's
+ * case table for this switch instead of comparing it with each case. */
+COLDC_OP(switch_table) {
+    Method      * method = cur_frame->method;
+    Int           pc = cur_frame->pc - 1;
+    cData       * val = &stack[stack_pos - 1], dest;
+    SwitchTable * table;
+
+    /* 1.0 equals a case 1, but does not hash like it; compare in turn. */
+    if (val->type == FLOAT) {
+        cur_frame->pc++;
+        return;
+    }
+
+    for (table = method->switches; table; table = table->next) {
+        if (table->pc == pc)
+            break;
+    }
+    if (!table) {
+        table = EMALLOC(SwitchTable, 1);
+        table->pc = pc;
+        table->cases = dict_new_empty();
+        switch_table_cases(method, pc, table);
+        table->next = method->switches;
+        method->switches = table;
+    }
+
+    if (dict_find(table->cases, val, &dest) == keynf_id) {
+        /* DEFAULT pops the switch value. */
+        cur_frame->pc = table->default_pc;
+    } else {
+        pop(1);
+        cur_frame->pc = dest.u.val;
+    }
+}
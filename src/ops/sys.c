@@ -261,6 +261,21 @@ COLDC_FUNC(set_heartbeat) {
             return; \
         }
 
+#define _CONFIG_RANGE(id, var, min, max) \
+        if (SYM1 == id) { \
+            if (argc == 2) { \
+                if (args[ARG2].type != INTEGER) \
+                    THROW((type_id, "Expected an integer")); \
+                if (INT2 < (min) || INT2 > (max)) \
+                    THROW((range_id, "Expected an integer from %d to %d.", \
+                           (Int) (min), (Int) (max))); \
+                var = INT2; \
+            } \
+            pop(argc); \
+            push_int(var); \
+            return; \
+        }
+
 #define _CONFIG_CLEANERWAIT(id, var) \
         if (SYM1 == id) { \
             if (argc == 2) { \
@@ -274,6 +289,47 @@ COLDC_FUNC(set_heartbeat) {
             return; \
         }
 
+#define _CONFIG_CACHESIZE(id, var) \
+        if (SYM1 == id) { \
+            if (argc == 2) { \
+                if (args[ARG2].type != INTEGER) \
+                    THROW((type_id, "Expected an integer")); \
+                if (INT2 < 1) \
+                    THROW((range_id, "The cache size must be at least 1.")); \
+                cache_resize(INT2); \
+            } \
+            pop(argc); \
+            push_int(var); \
+            return; \
+        }
+
+#define _CONFIG_CACHEBYTES(id, var) \
+        if (SYM1 == id) { \
+            if (argc == 2) { \
+                if (args[ARG2].type != INTEGER) \
+                    THROW((type_id, "Expected an integer")); \
+                if (INT2 < 0) \
+                    THROW((range_id, "The cache byte limit cannot be negative.")); \
+                cache_set_bytes(INT2); \
+            } \
+            pop(argc); \
+            push_int(var); \
+            return; \
+        }
+
+#define _CONFIG_CACHEPOLICY(id) \
+        if (SYM1 == id) { \
+            if (argc == 2) { \
+                if (args[ARG2].type != SYMBOL) \
+                    THROW((type_id, "Expected a symbol")); \
+                if (!cache_set_policy(SYM2)) \
+                    THROW((type_id, "Unknown cache policy %I.", SYM2)); \
+            } \
+            pop(argc); \
+            push_symbol(cache_policy()); \
+            return; \
+        }
+
 #define _CONFIG_OBJNUM(id, var) \
         if (SYM1 == id) { \
             if (argc == 2) { \
@@ -325,6 +381,13 @@ COLDC_FUNC(config) {
 #ifdef USE_CACHE_HISTORY
     _CONFIG_INT(cache_history_size_id,         cache_history_size)
 #endif
+    _CONFIG_RANGE(read_budget_id,              read_budget, 0, MAX_READ_BUDGET)
+    _CONFIG_RANGE(read_highwater_id,           read_highwater, 0, MAX_INT)
+    _CONFIG_INT(dns_cache_ttl_id,              dns_cache_ttl)
+    _CONFIG_INT(compact_budget_id,             compact_budget)
+    _CONFIG_CACHESIZE(cache_size_id,           cache_size)
+    _CONFIG_CACHEPOLICY(cache_policy_id)
+    _CONFIG_CACHEBYTES(cache_bytes_id,         cache_bytes)
     THROW((type_id, "Invalid configuration name."));
 }
 
@@ -381,7 +444,7 @@ COLDC_FUNC(cache_stats) {
         val[1].type = INTEGER;
         val[1].u.val = name_cache_misses;
     } else if (SYM1 == object_cache_id) {
-        THROW((type_id, "Object cache stats not yet supported."));
+        list = object_cache_info();
     } else {
         THROW((type_id, "Invalid cache type."));
     }